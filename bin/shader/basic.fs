@@ -15,16 +15,16 @@ struct DirLight {
     vec3 specular;
 };
 
+// The floats fill the space left after each vec3, see pointLight in lighting.h
 struct PointLight {
     vec3 position;
-    
     float constant;
-    float linear;
-    float quadratic;
-	
     vec3 ambient;
+    float linear;
     vec3 diffuse;
+    float quadratic;
     vec3 specular;
+    float radius;
 };
 
 struct SpotLight {
@@ -45,12 +45,35 @@ struct SpotLight {
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
+flat in uint BlockType;
 
-uniform vec3 viewPos;
-uniform int numPointLights;
-uniform DirLight dirLight;
 uniform Material material;
-uniform PointLight pointLights[100];
+
+// Written once per frame, see CameraUniforms in camera.h and LightUniforms in lighting.h
+layout (std140, binding = 0) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+
+layout (std140, binding = 1) uniform Lights {
+    DirLight dirLight;
+    ivec4 clusterCount; // Tiles across, tiles down and depth slices
+    vec4 clusterScale;  // Scale and bias turning log view depth into a slice, then the tile size in pixels
+};
+
+// Point lights binned into a view space grid on the CPU, see LightClusters in lighting.h
+layout (std430, binding = 2) readonly buffer PointLights {
+    PointLight pointLights[];
+};
+
+layout (std430, binding = 3) readonly buffer Clusters {
+    uvec2 clusters[]; // Offset and count of the cluster's lights in clusterLights
+};
+
+layout (std430, binding = 4) readonly buffer ClusterLights {
+    uint clusterLights[];
+};
 
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
@@ -70,14 +93,21 @@ void main()
 {
     
     vec3 norm = normalize(Normal);
-    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 viewDir = normalize(viewPos.xyz - FragPos);
 
     vec3 result = CalcDirLight(dirLight, norm, viewDir);
 
-    if(numPointLights != 0) {
-        for(int i = 0; i < numPointLights; i++) {
-            result += CalcPointLight(pointLights[i], norm, FragPos, viewPos);
-        }
+    // Only the lights that reach this fragment's cluster are evaluated
+    float depth = -(view * vec4(FragPos, 1.0)).z;
+    int slice = clamp(int(log(depth) * clusterScale.x + clusterScale.y), 0, clusterCount.z - 1);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy / clusterScale.zw), ivec2(0), clusterCount.xy - 1);
+    uvec2 cluster = clusters[(slice * clusterCount.y + tile.y) * clusterCount.x + tile.x];
+    for(uint i = 0u; i < cluster.y; i++) {
+        result += CalcPointLight(pointLights[clusterLights[cluster.x + i]], norm, FragPos, viewPos.xyz);
+    }
+    // Same numbering as the BlockType enum in block.h, water shares the dirt texture so it is tinted here
+    if(BlockType == 2u) {
+        result *= vec3(0.25, 0.45, 0.9);
     }
     FragColor = vec4(result, 1.0);
 }
@@ -1,21 +1,42 @@
 #version 460 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
-layout (location = 2) in vec2 aTexCoords;
+layout (location = 0) in uint aPosition;
+layout (location = 1) in uint aTexture;
+layout (location = 2) in ivec3 aOrigin; // Per section, picked by the draw's base instance
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
+flat out uint BlockType;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Written once per frame, see CameraUniforms in camera.h
+layout (std140, binding = 0) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+
+// Same order as the Face enum in block.h
+const vec3 faceNormals[6] = vec3[6](
+    vec3( 0.0,  0.0,  1.0), // FRONT
+    vec3( 0.0,  0.0, -1.0), // BACK
+    vec3(-1.0,  0.0,  0.0), // LEFT
+    vec3( 1.0,  0.0,  0.0), // RIGHT
+    vec3( 0.0,  1.0,  0.0), // TOP
+    vec3( 0.0, -1.0,  0.0)  // BOTTOM
+);
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
+    // Unpacks the vertex, see the Vertex struct in block.h for the layout
+    vec3 aPos = vec3(aPosition & 63u, (aPosition >> 6) & 63u, (aPosition >> 12) & 63u) + vec3(aOrigin);
+    vec3 aNormal = faceNormals[(aPosition >> 18) & 7u];
+    vec2 aTexCoords = vec2(aTexture & 63u, (aTexture >> 6) & 63u);
+
+    // Sections are only ever translated, so the world position and the face normal need no model matrix
+    FragPos = aPos;
     TexCoords = aTexCoords;
-    Normal = mat3(transpose(inverse(model))) * aNormal; 
+    BlockType = aTexture >> 12;
+    Normal = aNormal;
     // Apply the view and projection transformations
-    gl_Position = projection * view * model * vec4(aPos, 1.0); 
-}
\ No newline at end of file
+    gl_Position = projection * view * vec4(aPos, 1.0);
+}
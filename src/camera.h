@@ -19,6 +19,15 @@ typedef struct {
     mat4 view;
 } Cam;
 
+#define CAMERA_BINDING 0 // Binding of the Camera uniform block in basic.vs and basic.fs
+
+// The Camera uniform block in std140 layout, filled once per frame
+typedef struct {
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos; // w is unused
+} CameraUniforms;
+
 Cam createCamera(vec3 pos, float speed, float fov, float sens) {
     Cam cam;
     glm_vec3_copy(pos, cam.cameraPos);
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Open addressing hash map from chunk coordinates to slots in the world's chunk pool.
+// Entries live inline in one array with linear probing, removal shifts the following entries back
+// so there are no tombstones and lookups never walk further than the longest run.
+typedef struct {
+    int cx, cz;
+    int slot; // -1 marks an empty entry
+} ChunkMapEntry;
+
+typedef struct {
+    ChunkMapEntry* entries;
+    uint32_t mask;
+    int count;
+} ChunkMap;
+
+uint32_t hashChunkCoord(int cx, int cz) {
+    uint32_t h = (uint32_t)cx * 0x9E3779B1u ^ (uint32_t)cz * 0x85EBCA77u;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 13;
+    return h;
+}
+
+// The table is kept at most half full so probe runs stay short
+bool createChunkMap(ChunkMap* map, int maxEntries) {
+    uint32_t capacity = 16;
+    while(capacity < (uint32_t)maxEntries * 2) {
+        capacity <<= 1;
+    }
+    map->entries = (ChunkMapEntry*)malloc(sizeof(ChunkMapEntry) * capacity);
+    if(!map->entries) {
+        fprintf(stderr, "Failed to allocate the chunk map!\n");
+        return false;
+    }
+    map->mask = capacity - 1;
+    map->count = 0;
+    for(uint32_t i = 0; i < capacity; i++) {
+        map->entries[i].slot = -1;
+    }
+    return true;
+}
+
+void destroyChunkMap(ChunkMap* map) {
+    free(map->entries);
+    map->entries = NULL;
+}
+
+void clearChunkMap(ChunkMap* map) {
+    for(uint32_t i = 0; i <= map->mask; i++) {
+        map->entries[i].slot = -1;
+    }
+    map->count = 0;
+}
+
+// Returns the slot holding the chunk or -1 if it is not loaded
+int chunkMapFind(ChunkMap* map, int cx, int cz) {
+    uint32_t i = hashChunkCoord(cx, cz) & map->mask;
+    while(map->entries[i].slot != -1) {
+        if(map->entries[i].cx == cx && map->entries[i].cz == cz) {
+            return map->entries[i].slot;
+        }
+        i = (i + 1) & map->mask;
+    }
+    return -1;
+}
+
+void chunkMapInsert(ChunkMap* map, int cx, int cz, int slot) {
+    uint32_t i = hashChunkCoord(cx, cz) & map->mask;
+    while(map->entries[i].slot != -1) {
+        if(map->entries[i].cx == cx && map->entries[i].cz == cz) {
+            map->entries[i].slot = slot;
+            return;
+        }
+        i = (i + 1) & map->mask;
+    }
+    map->entries[i] = (ChunkMapEntry){cx, cz, slot};
+    map->count++;
+}
+
+void chunkMapRemove(ChunkMap* map, int cx, int cz) {
+    uint32_t i = hashChunkCoord(cx, cz) & map->mask;
+    while(map->entries[i].slot != -1) {
+        if(map->entries[i].cx == cx && map->entries[i].cz == cz) {
+            break;
+        }
+        i = (i + 1) & map->mask;
+    }
+    if(map->entries[i].slot == -1) {
+        return;
+    }
+    // Moves later entries of the probe run into the hole if the hole is between them and their home bucket
+    uint32_t hole = i;
+    uint32_t j = i;
+    while(1) {
+        j = (j + 1) & map->mask;
+        if(map->entries[j].slot == -1) {
+            break;
+        }
+        uint32_t home = hashChunkCoord(map->entries[j].cx, map->entries[j].cz) & map->mask;
+        if(((j - home) & map->mask) >= ((j - hole) & map->mask)) {
+            map->entries[hole] = map->entries[j];
+            hole = j;
+        }
+    }
+    map->entries[hole].slot = -1;
+    map->count--;
+}
@@ -0,0 +1,32 @@
+#include <stdbool.h>
+
+// The bundled glad only goes up to GL 4.0, everything newer the renderer uses is declared and loaded here.
+// A glad generated for a newer version already has these, so each is only declared when glad has not.
+#ifndef GL_VERSION_4_3
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+PFNGLMULTIDRAWELEMENTSINDIRECTPROC glad_glMultiDrawElementsIndirect;
+#define glMultiDrawElementsIndirect glad_glMultiDrawElementsIndirect
+#endif
+
+#ifndef GL_VERSION_4_4
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+PFNGLBUFFERSTORAGEPROC glad_glBufferStorage;
+#define glBufferStorage glad_glBufferStorage
+#endif
+
+// Call after gladLoadGLLoader. Returns false when multi draw indirect is missing, the renderer cannot draw without it.
+// glBufferStorage is optional and left NULL when missing, meshes are then uploaded without the staging ring.
+bool loadGLFunctions(GLADloadproc load) {
+    glad_glMultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)load("glMultiDrawElementsIndirect");
+    glad_glBufferStorage = (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage");
+    return glad_glMultiDrawElementsIndirect != NULL;
+}
+
+// Gives the bound buffer fresh storage before it is rewritten, so the driver never has to wait for draws
+// from earlier frames that still read the old contents
+void orphanBuffer(GLenum target, GLsizeiptr size, GLenum usage) {
+    glBufferData(target, size, NULL, usage);
+}
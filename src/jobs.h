@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "queue.h"
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#define JOB_CAPACITY 1024 // Jobs that can be queued or running at once
+
+typedef void (*JobFunction)(void* arg, int worker);
+
+typedef struct {
+    JobFunction function;
+    void* arg;
+} Job;
+
+typedef struct JobSystem JobSystem;
+
+typedef struct {
+    JobSystem* system;
+    int index;
+} WorkerInfo;
+
+// Jobs go through lock-free queues so submitting never takes a lock, the semaphore counts queued jobs and
+// puts idle workers to sleep. The mutex is only for waitForJobs, which is meant to block.
+struct JobSystem {
+    pthread_t* threads;
+    WorkerInfo* workers;
+    int threadCount;
+    Job* jobs;
+    Queue freeJobs; // Slots of jobs that are free to use
+    Queue pending;  // Submitted jobs in order
+    sem_t queued;
+    int outstanding; // Jobs submitted that have not finished yet
+    int running;
+    pthread_mutex_t mutex;
+    pthread_cond_t idle;
+};
+
+JobSystem jobSystem;
+
+int getCoreCount(void) {
+#ifdef _WIN32
+    int cores = pthread_num_processors_np();
+#else
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return cores > 0 ? cores : 1;
+}
+
+void* workerThread(void* vargp) {
+    WorkerInfo* info = (WorkerInfo*)vargp;
+    JobSystem* system = info->system;
+    while(1) {
+        while(sem_wait(&system->queued) != 0) {}
+        Job* slot;
+        // A job is always in the queue before it is counted, the queue can only look empty for a moment
+        // while another submission is still being written
+        while(!(slot = (Job*)dequeue(&system->pending)) && __atomic_load_n(&system->running, __ATOMIC_ACQUIRE)) {
+            sched_yield();
+        }
+        if(!slot) {
+            break;
+        }
+        Job job = *slot;
+        enqueue(&system->freeJobs, slot);
+
+        job.function(job.arg, info->index);
+
+        if(__atomic_sub_fetch(&system->outstanding, 1, __ATOMIC_ACQ_REL) == 0) {
+            pthread_mutex_lock(&system->mutex);
+            pthread_cond_broadcast(&system->idle);
+            pthread_mutex_unlock(&system->mutex);
+        }
+    }
+    return NULL;
+}
+
+// Starts the worker pool, a thread count of 0 or less creates one worker per core
+int createJobSystem(JobSystem* system, int threadCount) {
+    if(threadCount <= 0) {
+        threadCount = getCoreCount();
+    }
+    system->threadCount = threadCount;
+    system->outstanding = 0;
+    system->running = 1;
+    system->jobs = (Job*)malloc(sizeof(Job) * JOB_CAPACITY);
+    system->threads = (pthread_t*)malloc(sizeof(pthread_t) * threadCount);
+    system->workers = (WorkerInfo*)malloc(sizeof(WorkerInfo) * threadCount);
+    if(!system->jobs || !system->threads || !system->workers
+        || !createQueue(&system->freeJobs, JOB_CAPACITY) || !createQueue(&system->pending, JOB_CAPACITY)) {
+        fprintf(stderr, "Failed to allocate the job system!\n");
+        return 0;
+    }
+    for(int i = 0; i < JOB_CAPACITY; i++) {
+        enqueue(&system->freeJobs, &system->jobs[i]);
+    }
+    sem_init(&system->queued, 0, 0);
+    pthread_mutex_init(&system->mutex, NULL);
+    pthread_cond_init(&system->idle, NULL);
+    for(int i = 0; i < threadCount; i++) {
+        system->workers[i].system = system;
+        system->workers[i].index = i;
+        if(pthread_create(&system->threads[i], NULL, workerThread, &system->workers[i]) != 0) {
+            fprintf(stderr, "Failed to create worker thread %d!\n", i);
+            system->threadCount = i;
+            break;
+        }
+    }
+    return system->threadCount;
+}
+
+// Returns false without waiting when JOB_CAPACITY jobs are already outstanding, the job is not queued then
+bool submitJob(JobSystem* system, JobFunction function, void* arg) {
+    Job* slot = (Job*)dequeue(&system->freeJobs);
+    if(!slot) {
+        return false;
+    }
+    *slot = (Job){function, arg};
+    __atomic_add_fetch(&system->outstanding, 1, __ATOMIC_ACQ_REL);
+    // Every slot taken from the free list fits, so this cannot fail
+    enqueue(&system->pending, slot);
+    sem_post(&system->queued);
+    return true;
+}
+
+// Blocks until every submitted job has finished
+void waitForJobs(JobSystem* system) {
+    pthread_mutex_lock(&system->mutex);
+    while(__atomic_load_n(&system->outstanding, __ATOMIC_ACQUIRE) != 0) {
+        pthread_cond_wait(&system->idle, &system->mutex);
+    }
+    pthread_mutex_unlock(&system->mutex);
+}
+
+// Jobs still queued are run before the workers stop
+void destroyJobSystem(JobSystem* system) {
+    __atomic_store_n(&system->running, 0, __ATOMIC_RELEASE);
+    for(int i = 0; i < system->threadCount; i++) {
+        sem_post(&system->queued);
+    }
+    for(int i = 0; i < system->threadCount; i++) {
+        pthread_join(system->threads[i], NULL);
+    }
+    sem_destroy(&system->queued);
+    pthread_mutex_destroy(&system->mutex);
+    pthread_cond_destroy(&system->idle);
+    destroyQueue(&system->freeJobs);
+    destroyQueue(&system->pending);
+    free(system->jobs);
+    free(system->threads);
+    free(system->workers);
+}
@@ -1,65 +1,340 @@
 #include <cglm/cglm.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <float.h>
+#include <math.h>
 #include "shader.h"
 
-typedef struct 
+#define MAX_POINT_LIGHTS 1024
+#define LIGHTS_BINDING 1         // Binding of the Lights uniform block in basic.fs
+#define POINT_LIGHTS_BINDING 2   // Bindings of the shader storage blocks in basic.fs
+#define CLUSTERS_BINDING 3
+#define CLUSTER_LIGHTS_BINDING 4
+
+// View space grid the point lights are binned into, tiles across the screen and depth slices that grow
+// exponentially away from the camera so near and far clusters have about the same shape
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+#define CLUSTER_FAR 1024.0f // Slices stop growing here, the last one reaches on to the far plane
+#define CLUSTER_INDEX_MAX (CLUSTER_COUNT * 32) // Light references across all clusters
+#define LIGHT_CUTOFF (1.0f / 512.0f) // A light stops at the distance where it adds less than half a colour step
+
+// Fields are ordered so the struct matches PointLight in basic.fs, each vec3 is followed by a float
+typedef struct
 {
-	vec3 ambient;
-	vec3 diffuse;
-	vec3 specular;
+	vec3 position;
 	float constant;
+	vec3 ambient;
 	float linear;
+	vec3 diffuse;
 	float quadratic;
-	vec3 position;
+	vec3 specular;
+	float radius; // Set from the attenuation, lights are only binned into the clusters this reaches
 } pointLight;
 
-pointLight pointLightArr[100];
+// std140 puts every vec3 of DirLight on its own 16 bytes
+typedef struct
+{
+	vec3 direction;
+	float padding0;
+	vec3 ambient;
+	float padding1;
+	vec3 diffuse;
+	float padding2;
+	vec3 specular;
+	float padding3;
+} directionalLight;
+
+// The Lights uniform block, written once per frame
+typedef struct
+{
+	directionalLight dirLight;
+	int clusterCount[4]; // Tiles across, tiles down and depth slices, w is unused
+	vec4 clusterScale;   // Scale and bias turning log view depth into a slice, then the tile size in pixels
+} LightUniforms;
+
+// Lights are binned on the CPU each frame. Each cluster gets an offset and count into one list of light indices,
+// so the fragment shader only loops over the lights that reach its cluster.
+typedef struct
+{
+	vec3 bounds[CLUSTER_COUNT][2]; // View space boxes, only rebuilt when the projection or framebuffer changes
+	GLuint ranges[CLUSTER_COUNT][2];
+	GLuint* indices;
+	int* pairs;  // Cluster and light of every overlap found while binning
+	int indexCount;
+	float fovy, aspect, near, far;
+	int width, height;
+	long dropped; // Overlaps left out of the last build because the index list was full
+	GLuint lightBuffer;
+	GLuint clusterBuffer;
+	GLuint indexBuffer;
+} LightClusters;
+
+LightUniforms lightUniforms;
+pointLight pointLightArr[MAX_POINT_LIGHTS];
 int numOfPointLights = 0;
+LightClusters lightClusters;
+
+// Distance at which the light's attenuation brings its brightest channel under LIGHT_CUTOFF
+float pointLightRadius(pointLight* light) {
+	float brightest = 0.0f;
+	for(int i = 0; i < 3; i++) {
+		brightest = glm_max(brightest, light->ambient[i] + light->diffuse[i] + light->specular[i]);
+	}
+	// Solves constant + linear * d + quadratic * d * d = brightest / LIGHT_CUTOFF
+	float c = light->constant - brightest / LIGHT_CUTOFF;
+	if(c >= 0.0f) {
+		return 0.0f;
+	}
+	if(light->quadratic > 0.0f) {
+		return (-light->linear + sqrtf(light->linear * light->linear - 4.0f * light->quadratic * c)) / (2.0f * light->quadratic);
+	}
+	if(light->linear > 0.0f) {
+		return -c / light->linear;
+	}
+	return FLT_MAX;
+}
 
 void createPointLight(vec3 pos, vec3 amb, vec3 diff, vec3 spec, float constant, float lin, float quad) {
-	glm_vec3_copy(pos, pointLightArr[numOfPointLights].position);
-	glm_vec3_copy(amb, pointLightArr[numOfPointLights].ambient);
-	glm_vec3_copy(diff, pointLightArr[numOfPointLights].diffuse);
-	glm_vec3_copy(spec, pointLightArr[numOfPointLights].specular);
-	pointLightArr[numOfPointLights].constant = constant;
-	pointLightArr[numOfPointLights].linear = lin;
-	pointLightArr[numOfPointLights].quadratic = quad;
+	if(numOfPointLights == MAX_POINT_LIGHTS) {
+		fprintf(stderr, "No room for more than %d point lights!\n", MAX_POINT_LIGHTS);
+		return;
+	}
+	pointLight* light = &pointLightArr[numOfPointLights];
+	glm_vec3_copy(pos, light->position);
+	glm_vec3_copy(amb, light->ambient);
+	glm_vec3_copy(diff, light->diffuse);
+	glm_vec3_copy(spec, light->specular);
+	light->constant = constant;
+	light->linear = lin;
+	light->quadratic = quad;
+	light->radius = pointLightRadius(light);
 	numOfPointLights++;
 }
 
-void createDirLight(unsigned int shaderProgram, vec3 dir, vec3 ambient, vec3 spec, vec3 diff) {
-	glUniform3fv(glGetUniformLocation(shaderProgram, "dirLight.direction"), 1, dir);
-	glUniform3fv(glGetUniformLocation(shaderProgram, "dirLight.ambient"), 1, ambient);
-	glUniform3fv(glGetUniformLocation(shaderProgram, "dirLight.specular"), 1, spec);
-	glUniform3fv(glGetUniformLocation(shaderProgram, "dirLight.diffuse"), 1, diff);
+void createDirLight(vec3 dir, vec3 ambient, vec3 spec, vec3 diff) {
+	glm_vec3_copy(dir, lightUniforms.dirLight.direction);
+	glm_vec3_copy(ambient, lightUniforms.dirLight.ambient);
+	glm_vec3_copy(spec, lightUniforms.dirLight.specular);
+	glm_vec3_copy(diff, lightUniforms.dirLight.diffuse);
 }
 
-void pointLightShaderPassthrough(unsigned int shaderProgram) {
-	char baseName[50];
-	char fullName[100];
-	for(int i = 0; i < numOfPointLights; i++) {
-		snprintf(baseName, sizeof(baseName), "pointLights[%d]", i);
+GLuint createStorageBuffer(GLuint binding, GLsizeiptr size) {
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	return buffer;
+}
+
+bool createLightClusters(LightClusters* clusters) {
+	memset(clusters, 0, sizeof(LightClusters));
+	clusters->indices = (GLuint*)malloc(sizeof(GLuint) * CLUSTER_INDEX_MAX);
+	clusters->pairs = (int*)malloc(sizeof(int) * 2 * CLUSTER_INDEX_MAX);
+	if(!clusters->indices || !clusters->pairs) {
+		fprintf(stderr, "Failed to allocate the light clusters!\n");
+		free(clusters->indices);
+		free(clusters->pairs);
+		return false;
+	}
+	clusters->lightBuffer = createStorageBuffer(POINT_LIGHTS_BINDING, sizeof(pointLight) * MAX_POINT_LIGHTS);
+	clusters->clusterBuffer = createStorageBuffer(CLUSTERS_BINDING, sizeof(clusters->ranges));
+	clusters->indexBuffer = createStorageBuffer(CLUSTER_LIGHTS_BINDING, sizeof(GLuint) * CLUSTER_INDEX_MAX);
+	return true;
+}
+
+void destroyLightClusters(LightClusters* clusters) {
+	free(clusters->indices);
+	free(clusters->pairs);
+	glDeleteBuffers(1, &clusters->lightBuffer);
+	glDeleteBuffers(1, &clusters->clusterBuffer);
+	glDeleteBuffers(1, &clusters->indexBuffer);
+	memset(clusters, 0, sizeof(LightClusters));
+}
 
-		snprintf(fullName, sizeof(fullName), "%s.position", baseName);
-		setVec3(shaderProgram, fullName, pointLightArr[i].position);
+int clusterIndex(int x, int y, int z) {
+	return (z * CLUSTER_Y + y) * CLUSTER_X + x;
+}
 
-		snprintf(fullName, sizeof(fullName), "%s.ambient", baseName);
-		setVec3(shaderProgram, fullName, pointLightArr[i].ambient);
+// Near depth of a slice, slice CLUSTER_Z is the far plane
+float clusterSliceDepth(LightClusters* clusters, int z) {
+	if(z == CLUSTER_Z) {
+		return clusters->far;
+	}
+	return clusters->near * powf(CLUSTER_FAR / clusters->near, (float)z / CLUSTER_Z);
+}
 
-		snprintf(fullName, sizeof(fullName), "%s.diffuse", baseName);
-		setVec3(shaderProgram, fullName, pointLightArr[i].diffuse);
+int clusterSlice(LightClusters* clusters, float depth) {
+	if(depth <= clusters->near) {
+		return 0;
+	}
+	int z = (int)(logf(depth / clusters->near) / logf(CLUSTER_FAR / clusters->near) * CLUSTER_Z);
+	return z < CLUSTER_Z ? z : CLUSTER_Z - 1;
+}
+
+// Boxes around the frustum piece of every cluster, tiles split the screen evenly and y runs up like gl_FragCoord
+void buildClusterBounds(LightClusters* clusters) {
+	float tanX = tanf(clusters->fovy * 0.5f) * clusters->aspect;
+	float tanY = tanf(clusters->fovy * 0.5f);
+	for(int z = 0; z < CLUSTER_Z; z++) {
+		float depths[2] = {clusterSliceDepth(clusters, z), clusterSliceDepth(clusters, z + 1)};
+		for(int y = 0; y < CLUSTER_Y; y++) {
+			for(int x = 0; x < CLUSTER_X; x++) {
+				vec3* box = clusters->bounds[clusterIndex(x, y, z)];
+				glm_vec3_copy((vec3){FLT_MAX, FLT_MAX, FLT_MAX}, box[0]);
+				glm_vec3_copy((vec3){-FLT_MAX, -FLT_MAX, -FLT_MAX}, box[1]);
+				for(int corner = 0; corner < 8; corner++) {
+					float ndcX = 2.0f * (x + (corner & 1)) / CLUSTER_X - 1.0f;
+					float ndcY = 2.0f * (y + ((corner >> 1) & 1)) / CLUSTER_Y - 1.0f;
+					float depth = depths[corner >> 2];
+					vec3 point = {ndcX * tanX * depth, ndcY * tanY * depth, -depth};
+					glm_vec3_minv(box[0], point, box[0]);
+					glm_vec3_maxv(box[1], point, box[1]);
+				}
+			}
+		}
+	}
+}
+
+// Tiles the sphere can cover, found by projecting the corners of the box around it. A sphere that reaches
+// in front of the near plane can cover any of them.
+void sphereTileRange(LightClusters* clusters, vec3 centre, float radius, int range[4]) {
+	range[0] = 0;
+	range[1] = 0;
+	range[2] = CLUSTER_X - 1;
+	range[3] = CLUSTER_Y - 1;
+	if(-centre[2] - radius <= clusters->near) {
+		return;
+	}
+	float tanX = tanf(clusters->fovy * 0.5f) * clusters->aspect;
+	float tanY = tanf(clusters->fovy * 0.5f);
+	float low[2] = {FLT_MAX, FLT_MAX}, high[2] = {-FLT_MAX, -FLT_MAX};
+	for(int corner = 0; corner < 8; corner++) {
+		float depth = -centre[2] + (corner & 4 ? radius : -radius);
+		float ndc[2] = {
+			(centre[0] + (corner & 1 ? radius : -radius)) / (depth * tanX),
+			(centre[1] + (corner & 2 ? radius : -radius)) / (depth * tanY)
+		};
+		for(int i = 0; i < 2; i++) {
+			low[i] = glm_min(low[i], ndc[i]);
+			high[i] = glm_max(high[i], ndc[i]);
+		}
+	}
+	const int tiles[2] = {CLUSTER_X, CLUSTER_Y};
+	for(int i = 0; i < 2; i++) {
+		range[i] = (int)glm_clamp(floorf((low[i] + 1.0f) * 0.5f * tiles[i]), 0.0f, tiles[i] - 1.0f);
+		range[i + 2] = (int)glm_clamp(floorf((high[i] + 1.0f) * 0.5f * tiles[i]), 0.0f, tiles[i] - 1.0f);
+	}
+}
 
-		snprintf(fullName, sizeof(fullName), "%s.specular", baseName);
-		setVec3(shaderProgram, fullName, pointLightArr[i].specular);
+bool sphereTouchesBox(vec3 centre, float radius, vec3 box[2]) {
+	float distance = 0.0f;
+	for(int i = 0; i < 3; i++) {
+		float nearest = glm_clamp(centre[i], box[0][i], box[1][i]);
+		distance += (centre[i] - nearest) * (centre[i] - nearest);
+	}
+	return distance <= radius * radius;
+}
 
-		snprintf(fullName, sizeof(fullName), "%s.constant", baseName);
-		setFloat(shaderProgram, fullName, pointLightArr[i].constant);
+// Bins every point light into the clusters its radius reaches. Overlaps are collected per light and then
+// counting sorted by cluster, so each cluster's lights end up next to each other in light order.
+// A framebuffer with no area has no tiles, the last build is kept and nothing should be drawn.
+void buildLightClusters(LightClusters* clusters, mat4 view, float fovy, float aspect, float near, float far, int width, int height) {
+	clusters->dropped = 0;
+	if(width <= 0 || height <= 0) {
+		return;
+	}
+	if(fovy != clusters->fovy || aspect != clusters->aspect || near != clusters->near || far != clusters->far
+		|| width != clusters->width || height != clusters->height) {
+		clusters->fovy = fovy;
+		clusters->aspect = aspect;
+		clusters->near = near;
+		clusters->far = far;
+		clusters->width = width;
+		clusters->height = height;
+		buildClusterBounds(clusters);
+	}
+	int pairCount = 0;
+	for(int i = 0; i < numOfPointLights; i++) {
+		pointLight* light = &pointLightArr[i];
+		vec3 centre;
+		glm_mat4_mulv3(view, light->position, 1.0f, centre);
+		float radius = light->radius;
+		if(-centre[2] + radius < near) {
+			continue;
+		}
+		int firstSlice = clusterSlice(clusters, -centre[2] - radius);
+		int lastSlice = clusterSlice(clusters, -centre[2] + radius);
+		int tiles[4];
+		sphereTileRange(clusters, centre, radius, tiles);
+		for(int z = firstSlice; z <= lastSlice; z++) {
+			for(int y = tiles[1]; y <= tiles[3]; y++) {
+				for(int x = tiles[0]; x <= tiles[2]; x++) {
+					int cluster = clusterIndex(x, y, z);
+					if(!sphereTouchesBox(centre, radius, clusters->bounds[cluster])) {
+						continue;
+					}
+					if(pairCount == CLUSTER_INDEX_MAX) {
+						clusters->dropped++;
+						continue;
+					}
+					clusters->pairs[pairCount * 2] = cluster;
+					clusters->pairs[pairCount * 2 + 1] = i;
+					pairCount++;
+				}
+			}
+		}
+	}
+	for(int i = 0; i < CLUSTER_COUNT; i++) {
+		clusters->ranges[i][1] = 0;
+	}
+	for(int i = 0; i < pairCount; i++) {
+		clusters->ranges[clusters->pairs[i * 2]][1]++;
+	}
+	GLuint offset = 0;
+	for(int i = 0; i < CLUSTER_COUNT; i++) {
+		clusters->ranges[i][0] = offset;
+		offset += clusters->ranges[i][1];
+		clusters->ranges[i][1] = 0;
+	}
+	for(int i = 0; i < pairCount; i++) {
+		GLuint* range = clusters->ranges[clusters->pairs[i * 2]];
+		clusters->indices[range[0] + range[1]++] = (GLuint)clusters->pairs[i * 2 + 1];
+	}
+	clusters->indexCount = pairCount;
 
-		snprintf(fullName, sizeof(fullName), "%s.linear", baseName);
-		setFloat(shaderProgram, fullName, pointLightArr[i].linear);
+	lightUniforms.clusterCount[0] = CLUSTER_X;
+	lightUniforms.clusterCount[1] = CLUSTER_Y;
+	lightUniforms.clusterCount[2] = CLUSTER_Z;
+	float logRange = logf(CLUSTER_FAR / near);
+	lightUniforms.clusterScale[0] = CLUSTER_Z / logRange;
+	lightUniforms.clusterScale[1] = -CLUSTER_Z * logf(near) / logRange;
+	lightUniforms.clusterScale[2] = (float)width / CLUSTER_X;
+	lightUniforms.clusterScale[3] = (float)height / CLUSTER_Y;
+}
 
-		snprintf(fullName, sizeof(fullName), "%s.quadratic", baseName);
-		setFloat(shaderProgram, fullName, pointLightArr[i].quadratic);
+void updateStorageBuffer(GLuint buffer, GLsizeiptr capacity, const void* data, GLsizeiptr size) {
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	orphanBuffer(GL_SHADER_STORAGE_BUFFER, capacity, GL_DYNAMIC_DRAW);
+	if(size > 0) {
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data);
 	}
-}
\ No newline at end of file
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// Called once per frame after the clusters are built, replaces setting every field of every light by name
+void updateLightUniforms(GLuint buffer, LightClusters* clusters) {
+	updateUniformBuffer(buffer, &lightUniforms, sizeof(LightUniforms));
+	updateStorageBuffer(clusters->lightBuffer, sizeof(pointLight) * MAX_POINT_LIGHTS, pointLightArr, sizeof(pointLight) * numOfPointLights);
+	updateStorageBuffer(clusters->clusterBuffer, sizeof(clusters->ranges), clusters->ranges, sizeof(clusters->ranges));
+	updateStorageBuffer(clusters->indexBuffer, sizeof(GLuint) * CLUSTER_INDEX_MAX, clusters->indices, sizeof(GLuint) * clusters->indexCount);
+}
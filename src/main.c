@@ -3,7 +3,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <cglm/cglm.h>
+#include "jobs.h"
 #include "block.h"
+#include "world.h"
 #include "camera.h"
 #include "lighting.h"
 #include "texture.h"
@@ -12,32 +14,45 @@ void framebufferSizeCallback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 
-void generateTerrain(int seed);
-void removeChunks(Chunk* chunks);
-void renderChunks(mat4 model, unsigned int shader);
+void drawOccluders(mat4 viewProjection, vec4 planes[6]);
+void renderChunks(mat4 viewProjection);
 
-void configureLighting(unsigned int shader);
-void configureMatrices(mat4 view, mat4 model, mat4 projection, unsigned int shader);
-void renderScene(unsigned int shader);
-
-void setMat4(unsigned int shaderProgram, const char* location, mat4 value);
+void configureLighting(mat4 view);
+void configureMatrices(mat4 view, mat4 projection);
+void renderScene(Shader* shader);
 
 float lastTime = 0;
 char title[256];
+int frameCount = 0;
+int sectionsDrawn = 0; // Sections drawn, left out by frustum culling and hidden by occlusion culling in the last frame
+int sectionsCulled = 0;
+int sectionsOccluded = 0;
 
 Cam cam;
 int windowedWidth = 1280; 
 int windowedHeight = 720;
+int framebufferWidth, framebufferHeight; // Kept up to date on resize, the light clusters are tiles of the framebuffer
+float nearPlane = 0.1f;
+float farPlane = 100000.0f;
 float deltaTime = 0.0f;	
 float lastFrame = 0.0f; 
-int renderDistance = 20;
+int renderDistance = 12; // Radius in chunks around the camera that is kept loaded
+int worldHeight = 4; // Sections of CHUNK_SIZE blocks stacked in each chunk column
+int threadCount = 0; // Number of terrain worker threads, 0 uses one per core
+long uploadBytesPerFrame = 2 * 1024 * 1024; // Mesh bytes moved onto the GPU each frame so streaming keeps frame times flat
+// Mode, scale, octaves, persistence, lacunarity, height range, sea level, cave shape and noise sample spacing of the terrain
+TerrainProfile terrainProfile = {TERRAIN_DENSITY, 128.0f, 5, 0.5f, 2.0f, 16.0f, 112.0f, 52, 24.0f, 8.0f, 0.3f, 4};
+int occlusionCulling = 1;
+int occluderDistance = 4; // Chunk columns around the camera whose solid plates are drawn into the occlusion buffer
 int wireFrame;
+GLuint cameraUniformBuffer; // Camera and light uniform blocks, written once per frame and shared by every draw
+GLuint lightUniformBuffer;
 
 int main(void) {
 	//Init GLfW and create the window
 	glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_SAMPLES, 16);
 	
@@ -46,7 +61,7 @@ int main(void) {
 		fprintf(stderr, "Failed to create the window of the application!");
 	}
 
-	cam = createCamera((vec3){(32 * renderDistance) / 2, 64, (32 * renderDistance) / 2}, 20.0f, 90.0f, 0.5f);
+	cam = createCamera((vec3){(32 * renderDistance) / 2, worldHeight * CHUNK_SIZE, (32 * renderDistance) / 2}, 20.0f, 90.0f, 0.5f);
 
 	lastX = (float)windowedWidth / 2.0f;
 	lastY = (float)windowedHeight / 2.0f;
@@ -54,14 +69,26 @@ int main(void) {
 	glfwMakeContextCurrent(window);
 	glfwSwapInterval(0);
 	glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
+	glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
 	glfwSetCursorPosCallback(window, mouse_callback);
 	glfwSetKeyCallback(window, key_callback);
 
 	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
 		printf("Failed to load GLAD");
 	}
+	if(!loadGLFunctions((GLADloadproc)glfwGetProcAddress)) {
+		fprintf(stderr, "OpenGL 4.3 multi draw indirect is not supported, Quiting!\n");
+		return -1;
+	}
 
-	unsigned int basicShader = createShader("shader/basic.vs", "shader/basic.fs");
+	Shader basicShader = createShader("shader/basic.vs", "shader/basic.fs");
+	cameraUniformBuffer = createUniformBuffer(CAMERA_BINDING, sizeof(CameraUniforms));
+	lightUniformBuffer = createUniformBuffer(LIGHTS_BINDING, sizeof(LightUniforms));
+	if(!createLightClusters(&lightClusters)) {
+		fprintf(stderr, "Failed to create the light clusters, Quiting!\n");
+		return -1;
+	}
+	createDirLight((vec3){-0.2f, -1.0f, -0.3f}, (vec3){1.0f, 1.0f, 1.0f}, (vec3){0.4f, 0.4f, 0.4f}, (vec3){0.4f, 0.4f, 0.4f});
 
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
@@ -69,18 +96,26 @@ int main(void) {
 	glFrontFace(GL_CCW);
 	glEnable(GL_MULTISAMPLE);
 
-	chunks = (Chunk*)malloc(sizeof(Chunk) * (renderDistance * renderDistance));
-	if(!chunks) {
-		fprintf(stderr, "Failed to alloctate chunk memory, Quiting!\n");
+	// Picked before the workers start so every chunk samples noise through the same kernel
+	noiseBackend = detectNoiseBackend();
+	printf("Noise backend: %s, gradients: %s\n", noiseBackendNames[noiseBackend], gradientModeNames[gradientMode]);
+
+	if(!createJobSystem(&jobSystem, threadCount)) {
+		fprintf(stderr, "Failed to start the terrain worker threads, Quiting!\n");
 		return -1;
 	}
-	
 
-	generateTerrain(time(NULL));
+	if(!createWorld(&world, renderDistance, worldHeight, time(NULL), jobSystem.threadCount, terrainProfile)) {
+		fprintf(stderr, "Failed to alloctate chunk memory, Quiting!\n");
+		return -1;
+	}
 
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED); 
 	textures[DIRT] = loadTexture("dirt.png");
-	glUniform1i(glGetUniformLocation(basicShader, "material.diffuse"), textures[DIRT]);
+	// Material uniforms never change, so they are set once instead of every frame
+	glUseProgram(basicShader.program);
+	setInt(&basicShader, "material.diffuse", 0);
+	setFloat(&basicShader, "material.shininess", 64.0f);
 
 	printf("%s", readShaderSource("shader/basic.vs"));
 
@@ -88,19 +123,33 @@ int main(void) {
         float currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        frameCount++;
+        if(currentFrame - lastTime >= 1.0f) {
+            snprintf(title, sizeof(title), "Computer science NEA coursework project - %d FPS, %d sections drawn, %d culled, %d occluded",
+                frameCount, sectionsDrawn, sectionsCulled, sectionsOccluded);
+            glfwSetWindowTitle(window, title);
+            frameCount = 0;
+            lastTime = currentFrame;
+        }
 
         processCameraInput(window, &cam, deltaTime);
+        updateWorld(&world, &jobSystem, cam.cameraPos, cam.cameraFront, uploadBytesPerFrame);
 
-        renderScene(basicShader);
+        renderScene(&basicShader);
 		
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
+	destroyWorld(&world, &jobSystem);
+	destroyJobSystem(&jobSystem);
+	destroyShader(&basicShader);
+	destroyLightClusters(&lightClusters);
 	glfwTerminate();
-	free(chunks);
 }
 void framebufferSizeCallback(GLFWwindow* window, int width, int height) {
 	glViewport(0, 0, width, height);
+	framebufferWidth = width;
+	framebufferHeight = height;
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
@@ -122,10 +171,6 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
 	glm_vec3_copy(direction, cam.cameraFront);
 }
 
-void setMat4(unsigned int shaderProgram, const char* location, mat4 value) {
-	glUniformMatrix4fv(glGetUniformLocation(shaderProgram, location), 1, GL_FALSE, (float*)value);
-}
-
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
 	if (key == GLFW_KEY_G && action == GLFW_RELEASE) {
 		if(wireFrame) {
@@ -137,70 +182,138 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 		}
 	}
+	if(key == GLFW_KEY_M && action == GLFW_RELEASE) {
+		// Rebuilds the loaded chunks with the other mesher, the seed stays the same
+		meshMode = meshMode == MESH_GREEDY ? MESH_NAIVE : MESH_GREEDY;
+		printf("\nMeshing mode: %s\n", meshMode == MESH_GREEDY ? "greedy" : "naive");
+		resetWorld(&world, &jobSystem, world.seed);
+	}
+	if(key == GLFW_KEY_N && action == GLFW_RELEASE) {
+		// Workers read the gradient mode, so it only flips once they are idle
+		waitForJobs(&jobSystem);
+		gradientMode = gradientMode == GRADIENT_TABLE ? GRADIENT_HASH : GRADIENT_TABLE;
+		printf("\nNoise gradients: %s\n", gradientModeNames[gradientMode]);
+		resetWorld(&world, &jobSystem, world.seed);
+	}
+	if(key == GLFW_KEY_T && action == GLFW_RELEASE) {
+		// Workers read the profile through the world, so it only changes once they are idle
+		waitForJobs(&jobSystem);
+		world.profile.mode = world.profile.mode == TERRAIN_DENSITY ? TERRAIN_HEIGHTMAP : TERRAIN_DENSITY;
+		printf("\nTerrain: %s\n", terrainModeNames[world.profile.mode]);
+		resetWorld(&world, &jobSystem, world.seed);
+	}
+	if(key == GLFW_KEY_O && action == GLFW_RELEASE) {
+		occlusionCulling = !occlusionCulling;
+		printf("\nOcclusion culling: %s\n", occlusionCulling ? "on" : "off");
+	}
+	if(key == GLFW_KEY_F && action == GLFW_RELEASE) {
+		defragmentMeshBuffer(&meshBuffer);
+		printMeshBufferStats(&meshBuffer);
+	}
+	if(key == GLFW_KEY_L && action == GLFW_RELEASE) {
+		// Drops a torch at the camera, the clusters keep the cost of each one to the blocks it reaches
+		createPointLight(cam.cameraPos, (vec3){0.05f, 0.03f, 0.01f}, (vec3){1.0f, 0.6f, 0.25f}, (vec3){0.3f, 0.2f, 0.1f}, 1.0f, 0.22f, 0.2f);
+		printf("\nPoint lights: %d, %d cluster references last frame, %ld dropped for lack of room\n", numOfPointLights,
+			lightClusters.indexCount, lightClusters.dropped);
+	}
+	if(key == GLFW_KEY_P && action == GLFW_RELEASE) {
+		printSamplingReport(&world.profile, world.seed, 64, world.sectionCount);
+	}
 	if(key == GLFW_KEY_R && action == GLFW_RELEASE) {
-		
-		generateTerrain(time(NULL));
+		resetWorld(&world, &jobSystem, time(NULL));
 	}
 }
 
-void generateTerrain(int seed) {
-	float timeBefore = glfwGetTime();
-	for (int x = 0; x < renderDistance; x++) {
-		for (int z = 0; z < renderDistance; z++) {
-			Chunk newChunk; 
-			glm_vec3_copy((vec3){x * CHUNK_SIZE, 0, z * CHUNK_SIZE}, newChunk.pos);
-			createChunkData(&newChunk, seed);
-			createChunkMesh(&newChunk);
-			uploadChunkToGPU(&newChunk);
-			chunks[x * renderDistance + z] = newChunk;
+// Draws the solid plates of the sections near the camera into the occlusion buffer
+void drawOccluders(mat4 viewProjection, vec4 planes[6]) {
+	clearOcclusionBuffer(&occlusion, viewProjection);
+	for(int i = 0; i < world.slotCount; i++) {
+		Chunk* chunk = &world.chunks[i];
+		if(chunk->state != CHUNK_READY || abs(chunk->cx - world.centerX) > occluderDistance || abs(chunk->cz - world.centerZ) > occluderDistance) {
+			continue;
+		}
+		for(int s = 0; s < chunk->sectionCount; s++) {
+			vec3 bounds[2] = {
+				{chunk->pos[0], s * CHUNK_SIZE, chunk->pos[2]},
+				{chunk->pos[0] + CHUNK_SIZE, (s + 1) * CHUNK_SIZE, chunk->pos[2] + CHUNK_SIZE}
+			};
+			if(chunk->sections[s].nonAirCount > 0 && glm_aabb_frustum(bounds, planes)) {
+				drawSectionOccluders(&occlusion, chunk->sections[s].occluderLayers, bounds[0], cam.cameraPos);
+			}
 		}
 	}
-	float timeAfter = glfwGetTime();
-	printf("\nTime taken: %f\n", timeAfter - timeBefore);
-}
-
-void removeChunks(Chunk* chunks) {
-	free(chunks);
-	chunks = (Chunk*)malloc(sizeof(Chunk) * (renderDistance * renderDistance));
 }
 
-void renderChunks(mat4 model, unsigned int shader) {
-	for(int x = 0; x < renderDistance; x++) {
-		for(int z = 0; z < renderDistance; z++) {
-			glm_mat4_identity(model); // Reset model matrix
-			glm_translate(model, chunks[x * renderDistance + z].pos); // Apply chunk1's position
-			setMat4(shader, "model", model);
-			renderChunk(&chunks[x * renderDistance + z]);
+// Only sections whose bounds are inside the view frustum and not hidden behind nearby terrain are drawn
+void renderChunks(mat4 viewProjection) {
+	vec4 planes[6];
+	glm_frustum_planes(viewProjection, planes);
+	if(occlusionCulling) {
+		drawOccluders(viewProjection, planes);
+	}
+	sectionsDrawn = 0;
+	sectionsCulled = 0;
+	sectionsOccluded = 0;
+	for(int i = 0; i < world.slotCount; i++) {
+		Chunk* chunk = &world.chunks[i];
+		if(chunk->state != CHUNK_READY) {
+			continue;
+		}
+		for(int s = 0; s < chunk->sectionCount; s++) {
+			ChunkSection* section = &chunk->sections[s];
+			if(section->vertexCount == 0) {
+				continue;
+			}
+			vec3 bounds[2] = {
+				{chunk->pos[0], s * CHUNK_SIZE, chunk->pos[2]},
+				{chunk->pos[0] + CHUNK_SIZE, (s + 1) * CHUNK_SIZE, chunk->pos[2] + CHUNK_SIZE}
+			};
+			if(!glm_aabb_frustum(bounds, planes)) {
+				sectionsCulled++;
+				continue;
+			}
+			if(occlusionCulling && isBoxOccluded(&occlusion, bounds)) {
+				sectionsOccluded++;
+				continue;
+			}
+			sectionsDrawn++;
+			queueSectionDraw(&meshBuffer, section);
 		}
 	}
+	// Sections are placed by their integer origin, so there is no model matrix to set between draws
+	drawQueuedSections(&meshBuffer);
 }
 
-void configureLighting(unsigned int shader) {
-	glUniform3fv(glGetUniformLocation(shader, "viewPos"), 1, cam.cameraPos);
-	createDirLight(shader, (vec3){-0.2f, -1.0f, -0.3f}, (vec3){1.0f, 1.0f, 1.0f}, (vec3){0.4f, 0.4f, 0.4f}, (vec3){0.4f, 0.4f, 0.4f});
-	glUniform1f(glGetUniformLocation(shader, "material.shininess"), 64.0f);
-	glUniform1i(glGetUniformLocation(shader, "numPointLights"), numOfPointLights);
-	pointLightShaderPassthrough(shader);
+void configureLighting(mat4 view) {
+	float aspect = (float)windowedWidth / (float)windowedHeight;
+	buildLightClusters(&lightClusters, view, glm_rad(cam.fov), aspect, nearPlane, farPlane, framebufferWidth, framebufferHeight);
+	updateLightUniforms(lightUniformBuffer, &lightClusters);
 }
 
-void configureMatrices(mat4 view, mat4 model, mat4 projection, unsigned int shader) {
-	glm_mat4_identity(model);
-	glm_perspective(glm_rad(cam.fov), (float)windowedWidth / (float)windowedHeight, 0.1f, 100000.0f, projection);
+void configureMatrices(mat4 view, mat4 projection) {
+	glm_perspective(glm_rad(cam.fov), (float)windowedWidth / (float)windowedHeight, nearPlane, farPlane, projection);
 	updateView(cam, view);
-	setMat4(shader, "projection", projection);
-	setMat4(shader, "view", view);
+	CameraUniforms camera;
+	glm_mat4_copy(view, camera.view);
+	glm_mat4_copy(projection, camera.projection);
+	glm_vec4(cam.cameraPos, 1.0f, camera.viewPos);
+	updateUniformBuffer(cameraUniformBuffer, &camera, sizeof(CameraUniforms));
 }
 
-void renderScene(unsigned int shader) {
+void renderScene(Shader* shader) {
 	glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	glUseProgram(shader);
-
-	configureLighting(shader);
+	// Minimised, there is nothing to draw into and the light clusters would have tiles of no size
+	if(framebufferWidth == 0 || framebufferHeight == 0) {
+		return;
+	}
+	glUseProgram(shader->program);
 
-	mat4 model, projection, view;
-	configureMatrices(view, model, projection, shader);
+	mat4 projection, view, viewProjection;
+	configureMatrices(view, projection);
+	configureLighting(view);
+	glm_mat4_mul(projection, view, viewProjection);
 
-	renderChunks(model, shader);
+	renderChunks(viewProjection);
 }
\ No newline at end of file
@@ -0,0 +1,364 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+// Included from block.h once Vertex, ChunkSection and the quad index buffer exist
+
+#define MESH_PAGE_VERTICES (1 << 21) // 16 MB, a page is only made bigger for a mesh that would not fit otherwise
+#define MESH_PAGE_MAX 8
+#define MESH_ALIGN 64 // Ranges are rounded up to this many vertices so freed space is not cut into slivers
+
+// One indirect draw, the layout is fixed by GL
+typedef struct {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+} DrawCommand;
+
+typedef struct {
+    int offset; // In vertices
+    int size;
+} FreeRange;
+
+// One large vertex buffer and the VAO reading it. Free space is a list of ranges sorted by offset,
+// ranges that touch are merged as soon as they are freed.
+typedef struct {
+    GLuint VAO;
+    GLuint vertexBuffer;
+    int capacity;          // In vertices
+    int usedVertices;
+    FreeRange* freeRanges;
+    int freeCount;
+    int freeCapacity;
+    DrawCommand* commands; // Draws queued for the current frame
+    int commandCount;
+} MeshPage;
+
+typedef struct {
+    long allocations;
+    long frees;
+    long failures;       // Allocations that no page could take even after defragmenting
+    long defragmentations;
+    long verticesMoved;  // By defragmentation
+} MeshBufferStats;
+
+// Suballocates section meshes out of a few large pages so streaming and re-meshing reuse GPU memory instead of
+// asking the driver for new buffers. Each page is drawn with one multi draw, and each draw's base instance
+// picks the section origin out of an instanced attribute shared by every page.
+typedef struct {
+    MeshPage pages[MESH_PAGE_MAX];
+    int pageCount;
+    GLuint originBuffer;   // Four ints per section, indexed by section id
+    GLuint indirectBuffer;
+    ChunkSection* sections; // Every section in the world, defragmenting looks through them for a page's meshes
+    int sectionCount;       // Also the most draws a page can have
+    MeshBufferStats stats;
+} MeshBuffer;
+
+MeshBuffer meshBuffer;
+
+bool createMeshBuffer(MeshBuffer* buffer, ChunkSection* sections, int sectionCount) {
+    memset(buffer, 0, sizeof(MeshBuffer));
+    buffer->sections = sections;
+    buffer->sectionCount = sectionCount;
+    if(!reserveQuadIndices(1)) {
+        return false;
+    }
+    glGenBuffers(1, &buffer->originBuffer);
+    glGenBuffers(1, &buffer->indirectBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer->originBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLint) * 4 * sectionCount, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer->indirectBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawCommand) * sectionCount, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    return true;
+}
+
+// Points a page's VAO at its vertex buffer and the shared origin and index buffers
+void bindMeshPage(MeshBuffer* buffer, MeshPage* page) {
+    glBindVertexArray(page->VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, page->vertexBuffer);
+    // Integer attributes so the packed words reach the shader untouched
+    glEnableVertexAttribArray(0);
+    glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, sizeof(Vertex), (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(Vertex), (void*)offsetof(Vertex, texture));
+    glBindBuffer(GL_ARRAY_BUFFER, buffer->originBuffer);
+    glEnableVertexAttribArray(2);
+    glVertexAttribIPointer(2, 3, GL_INT, sizeof(GLint) * 4, (void*)0);
+    glVertexAttribDivisor(2, 1);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadIndexBuffer);
+    glBindVertexArray(0);
+}
+
+// Returns the new page's index, or -1 when there is no room for another page
+int createMeshPage(MeshBuffer* buffer, int vertices) {
+    if(buffer->pageCount == MESH_PAGE_MAX) {
+        return -1;
+    }
+    MeshPage* page = &buffer->pages[buffer->pageCount];
+    memset(page, 0, sizeof(MeshPage));
+    page->capacity = vertices > MESH_PAGE_VERTICES ? vertices : MESH_PAGE_VERTICES;
+    page->freeCapacity = 64;
+    page->freeRanges = (FreeRange*)malloc(sizeof(FreeRange) * page->freeCapacity);
+    page->commands = (DrawCommand*)malloc(sizeof(DrawCommand) * buffer->sectionCount);
+    if(!page->freeRanges || !page->commands) {
+        fprintf(stderr, "Failed to allocate a mesh page!\n");
+        free(page->freeRanges);
+        free(page->commands);
+        return -1;
+    }
+    glGenBuffers(1, &page->vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, page->vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)sizeof(Vertex) * page->capacity, NULL, GL_STATIC_DRAW);
+    if(glGetError() == GL_OUT_OF_MEMORY) {
+        fprintf(stderr, "Failed to allocate a mesh page of %d vertices!\n", page->capacity);
+        glDeleteBuffers(1, &page->vertexBuffer);
+        free(page->freeRanges);
+        free(page->commands);
+        return -1;
+    }
+    glGenVertexArrays(1, &page->VAO);
+    bindMeshPage(buffer, page);
+    page->freeRanges[0] = (FreeRange){0, page->capacity};
+    page->freeCount = 1;
+    return buffer->pageCount++;
+}
+
+void destroyMeshBuffer(MeshBuffer* buffer) {
+    for(int i = 0; i < buffer->pageCount; i++) {
+        MeshPage* page = &buffer->pages[i];
+        glDeleteVertexArrays(1, &page->VAO);
+        glDeleteBuffers(1, &page->vertexBuffer);
+        free(page->freeRanges);
+        free(page->commands);
+    }
+    glDeleteBuffers(1, &buffer->originBuffer);
+    glDeleteBuffers(1, &buffer->indirectBuffer);
+    memset(buffer, 0, sizeof(MeshBuffer));
+}
+
+int meshRangeSize(int vertices) {
+    return (vertices + MESH_ALIGN - 1) / MESH_ALIGN * MESH_ALIGN;
+}
+
+// Smallest free range of the page that fits, -1 when none does
+int findFreeRange(MeshPage* page, int size) {
+    int best = -1;
+    for(int i = 0; i < page->freeCount; i++) {
+        if(page->freeRanges[i].size >= size && (best < 0 || page->freeRanges[i].size < page->freeRanges[best].size)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+int largestFreeRange(MeshPage* page) {
+    int largest = 0;
+    for(int i = 0; i < page->freeCount; i++) {
+        if(page->freeRanges[i].size > largest) {
+            largest = page->freeRanges[i].size;
+        }
+    }
+    return largest;
+}
+
+// Puts a range back, merging it with the free ranges on either side
+bool releaseMeshRange(MeshPage* page, int offset, int size) {
+    int i = 0;
+    while(i < page->freeCount && page->freeRanges[i].offset < offset) {
+        i++;
+    }
+    bool before = i > 0 && page->freeRanges[i - 1].offset + page->freeRanges[i - 1].size == offset;
+    bool after = i < page->freeCount && offset + size == page->freeRanges[i].offset;
+    if(before && after) {
+        page->freeRanges[i - 1].size += size + page->freeRanges[i].size;
+        memmove(&page->freeRanges[i], &page->freeRanges[i + 1], sizeof(FreeRange) * (page->freeCount - i - 1));
+        page->freeCount--;
+    }
+    else if(before) {
+        page->freeRanges[i - 1].size += size;
+    }
+    else if(after) {
+        page->freeRanges[i].offset = offset;
+        page->freeRanges[i].size += size;
+    }
+    else {
+        if(page->freeCount == page->freeCapacity) {
+            FreeRange* grown = (FreeRange*)realloc(page->freeRanges, sizeof(FreeRange) * page->freeCapacity * 2);
+            if(!grown) {
+                fprintf(stderr, "Failed to grow the mesh page free list, the range is lost until the next defragmentation!\n");
+                return false;
+            }
+            page->freeRanges = grown;
+            page->freeCapacity *= 2;
+        }
+        memmove(&page->freeRanges[i + 1], &page->freeRanges[i], sizeof(FreeRange) * (page->freeCount - i));
+        page->freeRanges[i] = (FreeRange){offset, size};
+        page->freeCount++;
+    }
+    return true;
+}
+
+int compareSectionMeshes(const void* a, const void* b) {
+    const ChunkSection* first = *(ChunkSection* const*)a;
+    const ChunkSection* second = *(ChunkSection* const*)b;
+    return first->firstVertex - second->firstVertex;
+}
+
+// Copies every mesh in the page into a fresh buffer, packed from the start, leaving all the free space as one range
+bool defragmentMeshPage(MeshBuffer* buffer, int pageIndex) {
+    MeshPage* page = &buffer->pages[pageIndex];
+    ChunkSection** live = (ChunkSection**)malloc(sizeof(ChunkSection*) * buffer->sectionCount);
+    if(!live) {
+        fprintf(stderr, "Failed to allocate the mesh defragmentation list!\n");
+        return false;
+    }
+    int liveCount = 0;
+    for(int i = 0; i < buffer->sectionCount; i++) {
+        ChunkSection* section = &buffer->sections[i];
+        if(section->meshCapacity > 0 && section->meshPage == pageIndex) {
+            live[liveCount++] = section;
+        }
+    }
+    qsort(live, liveCount, sizeof(ChunkSection*), compareSectionMeshes);
+    GLuint packed;
+    glGenBuffers(1, &packed);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, packed);
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)sizeof(Vertex) * page->capacity, NULL, GL_STATIC_DRAW);
+    if(glGetError() == GL_OUT_OF_MEMORY) {
+        fprintf(stderr, "Failed to allocate a buffer to defragment a mesh page into!\n");
+        glDeleteBuffers(1, &packed);
+        free(live);
+        return false;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, page->vertexBuffer);
+    int top = 0;
+    for(int i = 0; i < liveCount; i++) {
+        ChunkSection* section = live[i];
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr)sizeof(Vertex) * section->firstVertex,
+            (GLintptr)sizeof(Vertex) * top, (GLsizeiptr)sizeof(Vertex) * section->meshCapacity);
+        if(section->firstVertex != top) {
+            buffer->stats.verticesMoved += section->meshCapacity;
+        }
+        section->firstVertex = top;
+        top += section->meshCapacity;
+    }
+    free(live);
+    glDeleteBuffers(1, &page->vertexBuffer);
+    page->vertexBuffer = packed;
+    bindMeshPage(buffer, page);
+    page->freeRanges[0] = (FreeRange){top, page->capacity - top};
+    page->freeCount = top < page->capacity ? 1 : 0;
+    page->usedVertices = top;
+    buffer->stats.defragmentations++;
+    return true;
+}
+
+void defragmentMeshBuffer(MeshBuffer* buffer) {
+    for(int i = 0; i < buffer->pageCount; i++) {
+        if(buffer->pages[i].freeCount > 1) {
+            defragmentMeshPage(buffer, i);
+        }
+    }
+}
+
+// Finds room for the section's mesh, first in the free ranges of existing pages, then by defragmenting a page
+// with enough free space in total, and last in a new page
+bool allocateSectionMesh(MeshBuffer* buffer, ChunkSection* section) {
+    int size = meshRangeSize(section->vertexCount);
+    int pageIndex = -1, range = -1;
+    for(int i = 0; i < buffer->pageCount && range < 0; i++) {
+        range = findFreeRange(&buffer->pages[i], size);
+        pageIndex = i;
+    }
+    if(range < 0) {
+        pageIndex = -1;
+        for(int i = 0; i < buffer->pageCount && pageIndex < 0; i++) {
+            MeshPage* page = &buffer->pages[i];
+            if(page->capacity - page->usedVertices >= size && defragmentMeshPage(buffer, i)) {
+                pageIndex = i;
+            }
+        }
+        if(pageIndex < 0) {
+            pageIndex = createMeshPage(buffer, size);
+        }
+        if(pageIndex < 0) {
+            buffer->stats.failures++;
+            return false;
+        }
+        range = findFreeRange(&buffer->pages[pageIndex], size);
+    }
+    MeshPage* page = &buffer->pages[pageIndex];
+    FreeRange* chosen = &page->freeRanges[range];
+    section->meshPage = pageIndex;
+    section->firstVertex = chosen->offset;
+    section->meshCapacity = size;
+    chosen->offset += size;
+    chosen->size -= size;
+    if(chosen->size == 0) {
+        memmove(chosen, chosen + 1, sizeof(FreeRange) * (page->freeCount - range - 1));
+        page->freeCount--;
+    }
+    page->usedVertices += size;
+    buffer->stats.allocations++;
+    return true;
+}
+
+void freeSectionMesh(MeshBuffer* buffer, ChunkSection* section) {
+    if(section->meshCapacity == 0) {
+        return;
+    }
+    MeshPage* page = &buffer->pages[section->meshPage];
+    if(releaseMeshRange(page, section->firstVertex, section->meshCapacity)) {
+        page->usedVertices -= section->meshCapacity;
+    }
+    section->meshCapacity = 0;
+    buffer->stats.frees++;
+}
+
+void printMeshBufferStats(MeshBuffer* buffer) {
+    const double megabytes = sizeof(Vertex) / (1024.0 * 1024.0);
+    printf("Mesh buffer: %d pages, %ld allocations, %ld frees, %ld failed, %ld defragmentations moving %.1f MB\n",
+        buffer->pageCount, buffer->stats.allocations, buffer->stats.frees, buffer->stats.failures,
+        buffer->stats.defragmentations, buffer->stats.verticesMoved * megabytes);
+    for(int i = 0; i < buffer->pageCount; i++) {
+        MeshPage* page = &buffer->pages[i];
+        printf("  Page %d: %.1f of %.1f MB in use, %d free ranges, largest %.1f MB\n", i, page->usedVertices * megabytes,
+            page->capacity * megabytes, page->freeCount, largestFreeRange(page) * megabytes);
+    }
+}
+
+// Adds a draw of the section to this frame's multi draw of its page
+void queueSectionDraw(MeshBuffer* buffer, ChunkSection* section) {
+    if(section->vertexCount == 0 || section->meshCapacity == 0) {
+        return;
+    }
+    MeshPage* page = &buffer->pages[section->meshPage];
+    page->commands[page->commandCount++] = (DrawCommand){
+        (GLuint)(section->vertexCount / 4 * 6), 1, 0, section->firstVertex, (GLuint)section->id
+    };
+}
+
+// Draws the queued sections with one call per page
+void drawQueuedSections(MeshBuffer* buffer) {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer->indirectBuffer);
+    orphanBuffer(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawCommand) * buffer->sectionCount, GL_STREAM_DRAW);
+    int offset = 0;
+    for(int i = 0; i < buffer->pageCount; i++) {
+        MeshPage* page = &buffer->pages[i];
+        if(page->commandCount == 0) {
+            continue;
+        }
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawCommand) * offset, sizeof(DrawCommand) * page->commandCount, page->commands);
+        glBindVertexArray(page->VAO);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(sizeof(DrawCommand) * offset), page->commandCount, 0);
+        offset += page->commandCount;
+        page->commandCount = 0;
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+}
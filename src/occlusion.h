@@ -0,0 +1,314 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <cglm/cglm.h>
+
+#if defined(__SSE2__)
+#define OCCLUSION_SSE2
+#include <emmintrin.h>
+#endif
+
+// Software occlusion culling. Solid plates of nearby sections are rasterised on the CPU into a small depth buffer and the
+// bounds of everything else are tested against it, so hidden geometry never reaches the GPU. Nothing here
+// touches GL or the chunk types so it can run and be checked without a context, it only needs CHUNK_SIZE defined first.
+#define OCCLUSION_WIDTH 256 // Multiples of 4 so rows can be processed 4 pixels at a time
+#define OCCLUSION_HEIGHT 128
+#define OCCLUSION_NEAR 0.05f // Occluders are clipped to this clip space w, just in front of the camera's near plane
+#define OCCLUDER_TILE 8 // Side in blocks of the tiles occluder plates are found in
+#define OCCLUDER_TILES (CHUNK_SIZE / OCCLUDER_TILE)
+
+// For each axis and square tile across it, the completely solid layers nearest the low and high side of a section,
+// -1 when there are none. These plates are the simplified geometry drawn into the occlusion buffer.
+typedef int8_t OccluderLayers[3][2][OCCLUDER_TILES][OCCLUDER_TILES];
+
+// Depth is stored as 1 / w, which is linear in screen space and 0 where nothing has been drawn,
+// so a larger value is nearer the camera
+typedef struct {
+    float depth[OCCLUSION_HEIGHT][OCCLUSION_WIDTH];
+    mat4 viewProjection;
+    int occluders; // Quads drawn since the buffer was cleared
+} OcclusionBuffer;
+
+OcclusionBuffer occlusion;
+
+void clearOcclusionBuffer(OcclusionBuffer* buffer, mat4 viewProjection) {
+    memset(buffer->depth, 0, sizeof(buffer->depth));
+    glm_mat4_copy(viewProjection, buffer->viewProjection);
+    buffer->occluders = 0;
+}
+
+// Clip space to buffer pixels, z holds 1 / w
+static inline void projectOcclusionVertex(const vec4 clip, vec3 dest) {
+    float invW = 1.0f / clip[3];
+    dest[0] = (clip[0] * invW * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+    dest[1] = (clip[1] * invW * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+    dest[2] = invW;
+}
+
+static inline float edgeFunction(const vec3 a, const vec3 b, float x, float y) {
+    return (b[0] - a[0]) * (y - a[1]) - (b[1] - a[1]) * (x - a[0]);
+}
+
+// Keeps the nearest depth at every pixel that lies completely inside a convex polygon in buffer pixels.
+// Edges are moved in and depth out by half a pixel so partly covered pixels never hide anything, and drawing
+// the whole polygon at once leaves no gaps along the diagonals it would be split into as triangles.
+void rasterOccluderScreenPolygon(OcclusionBuffer* buffer, vec3* points, int count) {
+    float area = 0.0f;
+    int apex = 1;
+    for(int i = 1; i + 1 < count; i++) {
+        float triangle = edgeFunction(points[0], points[i], points[i + 1][0], points[i + 1][1]);
+        if(fabsf(triangle) > fabsf(area)) {
+            area = triangle;
+            apex = i;
+        }
+    }
+    if(fabsf(area) < 1e-6f) {
+        return;
+    }
+    float minX = points[0][0], maxX = points[0][0], minY = points[0][1], maxY = points[0][1];
+    for(int i = 1; i < count; i++) {
+        minX = fminf(minX, points[i][0]);
+        maxX = fmaxf(maxX, points[i][0]);
+        minY = fminf(minY, points[i][1]);
+        maxY = fmaxf(maxY, points[i][1]);
+    }
+    int x0 = minX < 0.0f ? 0 : ((int)minX & ~3);
+    int y0 = minY < 0.0f ? 0 : (int)minY;
+    int x1 = maxX > OCCLUSION_WIDTH ? OCCLUSION_WIDTH : (int)ceilf(maxX);
+    int y1 = maxY > OCCLUSION_HEIGHT ? OCCLUSION_HEIGHT : (int)ceilf(maxY);
+    if(x0 >= x1 || y0 >= y1) {
+        return;
+    }
+    // Edge values and depth are planes in screen space, so they step by a constant per pixel.
+    // Both are taken at the pixel corner where they are smallest.
+    float sign = area > 0.0f ? 1.0f : -1.0f;
+    float stepX[8], stepY[8], start[8];
+    for(int e = 0; e < count; e++) {
+        const float* p = points[e];
+        const float* q = points[(e + 1) % count];
+        stepX[e] = -(q[1] - p[1]) * sign;
+        stepY[e] = (q[0] - p[0]) * sign;
+        start[e] = edgeFunction(p, q, x0 + 0.5f, y0 + 0.5f) * sign - 0.5f * (fabsf(stepX[e]) + fabsf(stepY[e]));
+    }
+    // Barycentric weights of the largest triangle of the fan give the depth plane
+    const float* a = points[0];
+    const float* b = points[apex];
+    const float* c = points[apex + 1];
+    float depthX = ((c[1] - b[1]) * a[2] + (a[1] - c[1]) * b[2] + (b[1] - a[1]) * c[2]) / -area;
+    float depthY = ((b[0] - c[0]) * a[2] + (c[0] - a[0]) * b[2] + (a[0] - b[0]) * c[2]) / -area;
+    float depthStart = a[2] + depthX * (x0 + 0.5f - a[0]) + depthY * (y0 + 0.5f - a[1]) - 0.5f * (fabsf(depthX) + fabsf(depthY));
+    for(int y = y0; y < y1; y++) {
+        int row = y - y0;
+        float* depth = buffer->depth[y];
+#ifdef OCCLUSION_SSE2
+        __m128 lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+        __m128 edge[8], edgeStep[8];
+        for(int e = 0; e < count; e++) {
+            edge[e] = _mm_add_ps(_mm_set1_ps(start[e] + stepY[e] * row), _mm_mul_ps(lane, _mm_set1_ps(stepX[e])));
+            edgeStep[e] = _mm_set1_ps(stepX[e] * 4.0f);
+        }
+        __m128 z = _mm_add_ps(_mm_set1_ps(depthStart + depthY * row), _mm_mul_ps(lane, _mm_set1_ps(depthX)));
+        __m128 stepZ = _mm_set1_ps(depthX * 4.0f);
+        __m128 zero = _mm_setzero_ps();
+        for(int x = x0; x < x1; x += 4) {
+            __m128 inside = _mm_cmpge_ps(edge[0], zero);
+            edge[0] = _mm_add_ps(edge[0], edgeStep[0]);
+            for(int e = 1; e < count; e++) {
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(edge[e], zero));
+                edge[e] = _mm_add_ps(edge[e], edgeStep[e]);
+            }
+            __m128 old = _mm_loadu_ps(depth + x);
+            __m128 nearest = _mm_max_ps(old, z);
+            _mm_storeu_ps(depth + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+            z = _mm_add_ps(z, stepZ);
+        }
+#else
+        for(int x = x0; x < x1; x++) {
+            int column = x - x0;
+            bool inside = true;
+            for(int e = 0; e < count && inside; e++) {
+                inside = start[e] + stepY[e] * row + stepX[e] * column >= 0.0f;
+            }
+            if(inside) {
+                depth[x] = fmaxf(depth[x], depthStart + depthY * row + depthX * column);
+            }
+        }
+#endif
+    }
+}
+
+// Clips a convex polygon in clip space to w >= OCCLUSION_NEAR and draws it
+void rasterOccluderPolygon(OcclusionBuffer* buffer, vec4* clip, int count) {
+    vec4 clipped[8];
+    int clippedCount = 0;
+    for(int i = 0; i < count; i++) {
+        float* p = clip[i];
+        float* q = clip[(i + 1) % count];
+        bool pInside = p[3] >= OCCLUSION_NEAR;
+        bool qInside = q[3] >= OCCLUSION_NEAR;
+        if(pInside) {
+            glm_vec4_copy(p, clipped[clippedCount++]);
+        }
+        if(pInside != qInside) {
+            float t = (OCCLUSION_NEAR - p[3]) / (q[3] - p[3]);
+            glm_vec4_lerp(p, q, t, clipped[clippedCount]);
+            clipped[clippedCount++][3] = OCCLUSION_NEAR;
+        }
+    }
+    if(clippedCount < 3) {
+        return;
+    }
+    vec3 screen[8];
+    for(int i = 0; i < clippedCount; i++) {
+        projectOcclusionVertex(clipped[i], screen[i]);
+    }
+    rasterOccluderScreenPolygon(buffer, screen, clippedCount);
+}
+
+void drawOccluderQuad(OcclusionBuffer* buffer, vec3 corners[4]) {
+    vec4 clip[4];
+    for(int i = 0; i < 4; i++) {
+        glm_mat4_mulv(buffer->viewProjection, (vec4){corners[i][0], corners[i][1], corners[i][2], 1.0f}, clip[i]);
+    }
+    rasterOccluderPolygon(buffer, clip, 4);
+    buffer->occluders++;
+}
+
+// Block value 0 is air, like BLOCK_AIR in block.h
+bool isSolidTile(uint16_t blocks[CHUNK_SIZE][CHUNK_SIZE][CHUNK_SIZE], int axis, int layer, int tileU, int tileV) {
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+    int pos[3];
+    pos[axis] = layer;
+    for(int i = tileU * OCCLUDER_TILE; i < (tileU + 1) * OCCLUDER_TILE; i++) {
+        for(int j = tileV * OCCLUDER_TILE; j < (tileV + 1) * OCCLUDER_TILE; j++) {
+            pos[u] = i;
+            pos[v] = j;
+            if(blocks[pos[0]][pos[1]][pos[2]] == 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Caves leave few whole faces solid, but small solid plates inside a section are common and hide just as well
+void findOccluderLayers(OccluderLayers layers, uint16_t blocks[CHUNK_SIZE][CHUNK_SIZE][CHUNK_SIZE]) {
+    memset(layers, -1, sizeof(OccluderLayers));
+    for(int axis = 0; axis < 3; axis++) {
+        for(int i = 0; i < OCCLUDER_TILES; i++) {
+            for(int j = 0; j < OCCLUDER_TILES; j++) {
+                int low = 0;
+                while(low < CHUNK_SIZE && !isSolidTile(blocks, axis, low, i, j)) {
+                    low++;
+                }
+                if(low == CHUNK_SIZE) {
+                    continue;
+                }
+                int high = CHUNK_SIZE - 1;
+                while(high > low && !isSolidTile(blocks, axis, high, i, j)) {
+                    high--;
+                }
+                layers[axis][0][i][j] = (int8_t)low;
+                layers[axis][1][i][j] = (int8_t)high;
+            }
+        }
+    }
+}
+
+// Draws the side facing the eye of the section's solid plates nearest the eye.
+// Tiles with their plate in the same layer are merged into rectangles, since every edge loses half a pixel.
+void drawSectionOccluders(OcclusionBuffer* buffer, OccluderLayers occluders, vec3 origin, vec3 eye) {
+    for(int axis = 0; axis < 3; axis++) {
+        int u = (axis + 1) % 3;
+        int v = (axis + 2) % 3;
+        int side = eye[axis] < origin[axis] + CHUNK_SIZE * 0.5f ? 0 : 1;
+        int8_t layers[OCCLUDER_TILES][OCCLUDER_TILES];
+        memcpy(layers, occluders[axis][side], sizeof(layers));
+        for(int i = 0; i < OCCLUDER_TILES; i++) {
+            for(int j = 0; j < OCCLUDER_TILES; j++) {
+                int layer = layers[i][j];
+                if(layer < 0) {
+                    continue;
+                }
+                int width = 1, height = 1;
+                while(j + width < OCCLUDER_TILES && layers[i][j + width] == layer) {
+                    width++;
+                }
+                bool grow = true;
+                while(grow && i + height < OCCLUDER_TILES) {
+                    for(int k = 0; k < width && grow; k++) {
+                        grow = layers[i + height][j + k] == layer;
+                    }
+                    if(grow) {
+                        height++;
+                    }
+                }
+                for(int a = 0; a < height; a++) {
+                    memset(&layers[i + a][j], -1, width);
+                }
+                // Nothing is drawn for a plate the eye is inside of
+                float low = origin[axis] + layer;
+                if(eye[axis] > low && eye[axis] < low + 1.0f) {
+                    continue;
+                }
+                vec3 corners[4];
+                for(int c = 0; c < 4; c++) {
+                    corners[c][axis] = eye[axis] <= low ? low : low + 1.0f;
+                    corners[c][u] = origin[u] + (i + (c == 1 || c == 2) * height) * OCCLUDER_TILE;
+                    corners[c][v] = origin[v] + (j + (c >= 2) * width) * OCCLUDER_TILE;
+                }
+                drawOccluderQuad(buffer, corners);
+            }
+        }
+    }
+}
+
+// True when every pixel the box could cover already holds an occluder nearer than the nearest corner of the box.
+// Boxes reaching behind the near plane are never occluded.
+bool isBoxOccluded(OcclusionBuffer* buffer, vec3 bounds[2]) {
+    float minX = OCCLUSION_WIDTH, maxX = 0.0f, minY = OCCLUSION_HEIGHT, maxY = 0.0f, nearest = 0.0f;
+    for(int i = 0; i < 8; i++) {
+        vec4 corner = {bounds[i & 1][0], bounds[(i >> 1) & 1][1], bounds[(i >> 2) & 1][2], 1.0f};
+        vec4 clip;
+        glm_mat4_mulv(buffer->viewProjection, corner, clip);
+        if(clip[3] < OCCLUSION_NEAR) {
+            return false;
+        }
+        vec3 screen;
+        projectOcclusionVertex(clip, screen);
+        minX = fminf(minX, screen[0]);
+        maxX = fmaxf(maxX, screen[0]);
+        minY = fminf(minY, screen[1]);
+        maxY = fmaxf(maxY, screen[1]);
+        nearest = fmaxf(nearest, screen[2]);
+    }
+    int x0 = minX < 0.0f ? 0 : (int)minX;
+    int y0 = minY < 0.0f ? 0 : (int)minY;
+    int x1 = maxX >= OCCLUSION_WIDTH ? OCCLUSION_WIDTH : (int)maxX + 1;
+    int y1 = maxY >= OCCLUSION_HEIGHT ? OCCLUSION_HEIGHT : (int)maxY + 1;
+    if(x0 >= x1 || y0 >= y1) {
+        return false;
+    }
+    // A little slack so a box is never hidden by the faces of its own solid blocks
+    nearest *= 1.0001f;
+    for(int y = y0; y < y1; y++) {
+        const float* depth = buffer->depth[y];
+        int x = x0;
+#ifdef OCCLUSION_SSE2
+        __m128 limit = _mm_set1_ps(nearest);
+        for(; x + 4 <= x1; x += 4) {
+            if(_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(depth + x), limit))) {
+                return false;
+            }
+        }
+#endif
+        for(; x < x1; x++) {
+            if(depth[x] <= nearest) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
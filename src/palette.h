@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "pool.h"
+
+// Included from block.h once CHUNK_SIZE is defined
+#define PALETTE_VOLUME (CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE)
+#define PALETTE_MAX 16 // Chunks with more block types than this store the block values directly
+
+// Palette compressed blocks of one chunk. Each block is an index into a small palette of the block types
+// the chunk uses, packed into 64 bit words at the fewest bits that can index the palette. Indices are
+// in the same x, y, z order as a dense [x][y][z] array and never straddle two words.
+typedef struct {
+    uint16_t palette[PALETTE_MAX];
+    uint8_t paletteSize;
+    uint8_t bits;    // 0 when every block is palette[0], 1, 2 or 4 with a palette and 16 when values are stored directly
+    uint64_t* words; // From blockPool, NULL when bits is 0
+} BlockStorage;
+
+// Packed block words come from here, they are allocated on the workers and returned on the render thread
+Pool blockPool;
+
+size_t blockStorageBytes(const BlockStorage* storage) {
+    return (size_t)PALETTE_VOLUME * storage->bits / 8;
+}
+
+bool isUniformStorage(const BlockStorage* storage) {
+    return storage->bits == 0;
+}
+
+// Leaves the storage holding a single block type, releasing its packed words
+void fillBlockStorage(BlockStorage* storage, uint16_t block) {
+    poolFree(&blockPool, storage->words, blockStorageBytes(storage));
+    storage->words = NULL;
+    storage->bits = 0;
+    storage->palette[0] = block;
+    storage->paletteSize = 1;
+}
+
+uint8_t paletteBits(int paletteSize) {
+    if(paletteSize <= 1) return 0;
+    if(paletteSize <= 2) return 1;
+    if(paletteSize <= 4) return 2;
+    if(paletteSize <= PALETTE_MAX) return 4;
+    return 16;
+}
+
+static inline uint32_t getPackedIndex(const BlockStorage* storage, int index) {
+    uint32_t bit = (uint32_t)index * storage->bits;
+    uint64_t mask = ((uint64_t)1 << storage->bits) - 1;
+    return (uint32_t)((storage->words[bit >> 6] >> (bit & 63)) & mask);
+}
+
+static inline void setPackedIndex(BlockStorage* storage, int index, uint32_t value) {
+    uint32_t bit = (uint32_t)index * storage->bits;
+    uint64_t mask = ((uint64_t)1 << storage->bits) - 1;
+    uint64_t* word = &storage->words[bit >> 6];
+    *word = (*word & ~(mask << (bit & 63))) | ((uint64_t)value << (bit & 63));
+}
+
+uint16_t getStoredBlock(const BlockStorage* storage, int index) {
+    switch(storage->bits) {
+        case 0: return storage->palette[0];
+        case 16: return ((const uint16_t*)storage->words)[index];
+        default: return storage->palette[getPackedIndex(storage, index)];
+    }
+}
+
+// Rewrites the blocks at a new width, the palette has to already fit it
+bool repackBlockStorage(BlockStorage* storage, uint8_t bits) {
+    BlockStorage packed = *storage;
+    packed.bits = bits;
+    packed.words = (uint64_t*)poolAlloc(&blockPool, blockStorageBytes(&packed));
+    if(!packed.words) {
+        fprintf(stderr, "Failed to allocate chunk block storage!\n");
+        return false;
+    }
+    memset(packed.words, 0, blockStorageBytes(&packed));
+    if(storage->bits != 0) {
+        for(int i = 0; i < PALETTE_VOLUME; i++) {
+            uint32_t value = storage->bits == 16 ? getStoredBlock(storage, i) : getPackedIndex(storage, i);
+            if(bits == 16) {
+                ((uint16_t*)packed.words)[i] = storage->bits == 16 ? (uint16_t)value : storage->palette[value];
+            }
+            else {
+                setPackedIndex(&packed, i, value);
+            }
+        }
+    }
+    else if(bits == 16) {
+        for(int i = 0; i < PALETTE_VOLUME; i++) {
+            ((uint16_t*)packed.words)[i] = storage->palette[0];
+        }
+    }
+    poolFree(&blockPool, storage->words, blockStorageBytes(storage));
+    *storage = packed;
+    return true;
+}
+
+bool setStoredBlock(BlockStorage* storage, int index, uint16_t block) {
+    if(storage->bits == 16) {
+        ((uint16_t*)storage->words)[index] = block;
+        return true;
+    }
+    int entry = 0;
+    while(entry < storage->paletteSize && storage->palette[entry] != block) {
+        entry++;
+    }
+    if(entry == storage->paletteSize) {
+        if(paletteBits(storage->paletteSize + 1) != storage->bits
+            && !repackBlockStorage(storage, paletteBits(storage->paletteSize + 1))) {
+            return false;
+        }
+        if(storage->bits == 16) {
+            ((uint16_t*)storage->words)[index] = block;
+            return true;
+        }
+        storage->palette[storage->paletteSize++] = block;
+    }
+    if(storage->bits != 0) {
+        setPackedIndex(storage, index, (uint32_t)entry);
+    }
+    return true;
+}
+
+// Compresses a dense [x][y][z] array of blocks into the storage, replacing what it held
+bool packBlocks(BlockStorage* storage, const uint16_t* blocks) {
+    uint16_t palette[PALETTE_MAX];
+    int paletteSize = 0;
+    uint16_t last = blocks[0];
+    palette[paletteSize++] = last;
+    // Runs of the same block are common so only changes are looked up in the palette
+    for(int i = 1; i < PALETTE_VOLUME && paletteSize <= PALETTE_MAX; i++) {
+        if(blocks[i] == last) {
+            continue;
+        }
+        last = blocks[i];
+        int entry = 0;
+        while(entry < paletteSize && palette[entry] != last) {
+            entry++;
+        }
+        if(entry == paletteSize) {
+            if(paletteSize == PALETTE_MAX) {
+                paletteSize++;
+                break;
+            }
+            palette[paletteSize++] = last;
+        }
+    }
+    fillBlockStorage(storage, blocks[0]);
+    uint8_t bits = paletteBits(paletteSize);
+    if(bits == 0) {
+        return true;
+    }
+    storage->bits = bits;
+    storage->words = (uint64_t*)poolAlloc(&blockPool, blockStorageBytes(storage));
+    if(!storage->words) {
+        fprintf(stderr, "Failed to allocate chunk block storage!\n");
+        storage->bits = 0;
+        return false;
+    }
+    if(bits == 16) {
+        memcpy(storage->words, blocks, blockStorageBytes(storage));
+        return true;
+    }
+    memcpy(storage->palette, palette, sizeof(uint16_t) * paletteSize);
+    storage->paletteSize = (uint8_t)paletteSize;
+    // Each word is built up in a register and written once
+    int perWord = 64 / bits;
+    int entry = 0;
+    last = palette[0];
+    for(int w = 0; w < PALETTE_VOLUME / perWord; w++) {
+        uint64_t word = 0;
+        const uint16_t* block = blocks + w * perWord;
+        for(int i = 0; i < perWord; i++) {
+            if(block[i] != last) {
+                last = block[i];
+                entry = 0;
+                while(storage->palette[entry] != last) {
+                    entry++;
+                }
+            }
+            word |= (uint64_t)entry << (i * bits);
+        }
+        storage->words[w] = word;
+    }
+    return true;
+}
+
+// Expands the storage into a dense [x][y][z] array of blocks
+void unpackBlocks(const BlockStorage* storage, uint16_t* blocks) {
+    if(storage->bits == 0) {
+        for(int i = 0; i < PALETTE_VOLUME; i++) {
+            blocks[i] = storage->palette[0];
+        }
+        return;
+    }
+    if(storage->bits == 16) {
+        memcpy(blocks, storage->words, blockStorageBytes(storage));
+        return;
+    }
+    int bits = storage->bits;
+    int perWord = 64 / bits;
+    uint64_t mask = ((uint64_t)1 << bits) - 1;
+    for(int w = 0; w < PALETTE_VOLUME / perWord; w++) {
+        uint64_t word = storage->words[w];
+        uint16_t* block = blocks + w * perWord;
+        for(int i = 0; i < perWord; i++) {
+            block[i] = storage->palette[word & mask];
+            word >>= bits;
+        }
+    }
+}
@@ -3,14 +3,77 @@
 #include <time.h>
 #include <math.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NOISE_X86
+#include <immintrin.h>
+#endif
 
 typedef struct {
     float x;
     float y;
 } vector2; // 2D vector.
 
+// GRADIENT_HASH is the original hash and trig gradient and reproduces older terrain for a seed,
+// GRADIENT_TABLE looks gradients up from a seeded permutation table like improved Perlin noise
+typedef enum {GRADIENT_HASH, GRADIENT_TABLE} GradientMode;
+
+const char* gradientModeNames[] = {"hash", "table"};
+
+GradientMode gradientMode = GRADIENT_TABLE;
+
+#define NOISE_GRADIENTS 16
+
+typedef struct {
+    int seed;
+    uint8_t perm[512]; // A shuffle of 0 to 255 stored twice so the second lookup never has to wrap
+    vector2 gradients[NOISE_GRADIENTS]; // Unit vectors spread evenly around the circle
+} NoiseTable;
+
+// Read by the workers, so it is only rebuilt while no chunk jobs are running
+NoiseTable noiseTable;
+
+void buildNoiseTable(int seed) {
+    noiseTable.seed = seed;
+    for(int i = 0; i < 256; i++) {
+        noiseTable.perm[i] = (uint8_t)i;
+    }
+    // Fisher-Yates shuffle driven by xorshift so the same seed gives the same table on every platform
+    uint32_t state = (uint32_t)seed * 2654435761u ^ 0x9E3779B9u;
+    if(state == 0) {
+        state = 1;
+    }
+    for(int i = 255; i > 0; i--) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        int j = (int)(state % (uint32_t)(i + 1));
+        uint8_t swap = noiseTable.perm[i];
+        noiseTable.perm[i] = noiseTable.perm[j];
+        noiseTable.perm[j] = swap;
+    }
+    for(int i = 0; i < 256; i++) {
+        noiseTable.perm[i + 256] = noiseTable.perm[i];
+    }
+    for(int i = 0; i < NOISE_GRADIENTS; i++) {
+        double angle = i * (2.0 * 3.14159265358979 / NOISE_GRADIENTS);
+        noiseTable.gradients[i] = (vector2){ (float)cos(angle), (float)sin(angle) };
+    }
+}
+
+// The seed is already baked into the table, the lattice repeats every 256 cells along each axis
+static inline vector2 tableGradient(int ix, int iy) {
+    int index = noiseTable.perm[noiseTable.perm[ix & 255] + (iy & 255)];
+    return noiseTable.gradients[index & (NOISE_GRADIENTS - 1)];
+}
+
 // Creates a psuedo-Random value using a seed values, this is done so that the result of the alorithim can be replicated in perlin noise generation
 vector2 randomGradient(int ix, int iy, int seed) {
+    if(gradientMode == GRADIENT_TABLE) {
+        return tableGradient(ix, iy);
+    }
     const unsigned w = 8 * sizeof(unsigned);
     const unsigned s = w / 2; 
     unsigned a = ix + seed, b = iy + seed;
@@ -46,8 +109,9 @@ float smoothStep(float a, float b, float w) {
 }
 
 float perlinNoise(float x, float y, int seed) {
-    int x0 = (int)x;
-    int y0 = (int)y;
+    // Floored rather than truncated so negative coordinates use the cell below them instead of mirroring around zero
+    int x0 = (int)floorf(x);
+    int y0 = (int)floorf(y);
     int x1 = x0 + 1;
     int y1 = y0 + 1;
 
@@ -69,7 +133,11 @@ float perlinNoise(float x, float y, int seed) {
     return smoothStep(val1, val2, yf);
 }
 
+// No octaves gives flat noise of 0
 float fractalNoise(float scale, int octaves, float pers, float lac, int x, int y, int seed) {
+    if(octaves <= 0) {
+        return 0.0f;
+    }
     float val = 0.0f;
     float amplitude = 1.0f;
     float frequency = 1.0f;
@@ -81,5 +149,450 @@ float fractalNoise(float scale, int octaves, float pers, float lac, int x, int y
         amplitude *= pers;
         frequency *= lac;
     }
-    return val;
-}
\ No newline at end of file
+    // Dividing by the summed amplitudes keeps the result in the same range as a single octave
+    return val / maxHeight;
+}
+
+// Batch evaluation. A grid of samples shares its lattice gradients between neighbouring samples, so the
+// trig in randomGradient only runs when a row crosses into a new cell, and the per sample maths is done
+// several lanes at a time. Every step mirrors perlinNoise, including the double precision in smoothStep,
+// so the results are bit for bit the same as calling perlinNoise on each sample.
+
+typedef enum {NOISE_SCALAR, NOISE_SSE2, NOISE_AVX2} NoiseBackend;
+
+const char* noiseBackendNames[] = {"scalar", "SSE2", "AVX2"};
+
+// Chosen once at startup with detectNoiseBackend(), before any worker thread samples noise
+NoiseBackend noiseBackend = NOISE_SCALAR;
+
+#define NOISE_TILE 64
+
+// One row of up to NOISE_TILE samples, split into separate arrays so each loads straight into a SIMD register
+typedef struct {
+    float dx0[NOISE_TILE]; // Offset from the left lattice column, also the x weight
+    float dx1[NOISE_TILE]; // Offset from the right lattice column
+    float g00x[NOISE_TILE], g00y[NOISE_TILE]; // Gradients of the four corners of each sample's cell
+    float g10x[NOISE_TILE], g10y[NOISE_TILE];
+    float g01x[NOISE_TILE], g01y[NOISE_TILE];
+    float g11x[NOISE_TILE], g11y[NOISE_TILE];
+} NoiseRow;
+
+NoiseBackend detectNoiseBackend(void) {
+#ifdef NOISE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        return NOISE_AVX2;
+    }
+    if(__builtin_cpu_supports("sse2")) {
+        return NOISE_SSE2;
+    }
+#endif
+    return NOISE_SCALAR;
+}
+
+void noiseRowScalar(float* out, const NoiseRow* row, int start, int count, float dy0, float dy1) {
+    for(int i = start; i < count; i++) {
+        float c0 = row->dx0[i] * row->g00x[i] + dy0 * row->g00y[i];
+        float c1 = row->dx1[i] * row->g10x[i] + dy0 * row->g10y[i];
+        float val1 = smoothStep(c0, c1, row->dx0[i]);
+        float c2 = row->dx0[i] * row->g01x[i] + dy1 * row->g01y[i];
+        float c3 = row->dx1[i] * row->g11x[i] + dy1 * row->g11y[i];
+        float val2 = smoothStep(c2, c3, row->dx0[i]);
+        out[i] = smoothStep(val1, val2, dy0);
+    }
+}
+
+#ifdef NOISE_X86
+__attribute__((target("sse2")))
+static inline __m128d smoothStepSSE2Half(__m128d a, __m128d difference, __m128d w) {
+    __m128d curve = _mm_sub_pd(_mm_set1_pd(3.0), _mm_mul_pd(w, _mm_set1_pd(2.0)));
+    return _mm_add_pd(_mm_mul_pd(_mm_mul_pd(_mm_mul_pd(difference, curve), w), w), a);
+}
+
+// smoothStep on four lanes, widened to double in two halves like the scalar version
+__attribute__((target("sse2")))
+static inline __m128 smoothStepSSE2(__m128 a, __m128 b, __m128 w) {
+    __m128 difference = _mm_sub_ps(b, a);
+    __m128d low = smoothStepSSE2Half(_mm_cvtps_pd(a), _mm_cvtps_pd(difference), _mm_cvtps_pd(w));
+    __m128d high = smoothStepSSE2Half(_mm_cvtps_pd(_mm_movehl_ps(a, a)), _mm_cvtps_pd(_mm_movehl_ps(difference, difference)), _mm_cvtps_pd(_mm_movehl_ps(w, w)));
+    return _mm_movelh_ps(_mm_cvtpd_ps(low), _mm_cvtpd_ps(high));
+}
+
+__attribute__((target("sse2")))
+void noiseRowSSE2(float* out, const NoiseRow* row, int count, float dy0, float dy1) {
+    __m128 y0 = _mm_set1_ps(dy0);
+    __m128 y1 = _mm_set1_ps(dy1);
+    for(int i = 0; i < count; i += 4) {
+        __m128 dx0 = _mm_loadu_ps(&row->dx0[i]);
+        __m128 dx1 = _mm_loadu_ps(&row->dx1[i]);
+        __m128 c0 = _mm_add_ps(_mm_mul_ps(dx0, _mm_loadu_ps(&row->g00x[i])), _mm_mul_ps(y0, _mm_loadu_ps(&row->g00y[i])));
+        __m128 c1 = _mm_add_ps(_mm_mul_ps(dx1, _mm_loadu_ps(&row->g10x[i])), _mm_mul_ps(y0, _mm_loadu_ps(&row->g10y[i])));
+        __m128 c2 = _mm_add_ps(_mm_mul_ps(dx0, _mm_loadu_ps(&row->g01x[i])), _mm_mul_ps(y1, _mm_loadu_ps(&row->g01y[i])));
+        __m128 c3 = _mm_add_ps(_mm_mul_ps(dx1, _mm_loadu_ps(&row->g11x[i])), _mm_mul_ps(y1, _mm_loadu_ps(&row->g11y[i])));
+        __m128 val1 = smoothStepSSE2(c0, c1, dx0);
+        __m128 val2 = smoothStepSSE2(c2, c3, dx0);
+        _mm_storeu_ps(&out[i], smoothStepSSE2(val1, val2, y0));
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256d smoothStepAVX2Half(__m256d a, __m256d difference, __m256d w) {
+    __m256d curve = _mm256_sub_pd(_mm256_set1_pd(3.0), _mm256_mul_pd(w, _mm256_set1_pd(2.0)));
+    return _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(difference, curve), w), w), a);
+}
+
+// smoothStep on eight lanes, kept to separate multiplies and adds since a fused multiply add would round differently
+__attribute__((target("avx2")))
+static inline __m256 smoothStepAVX2(__m256 a, __m256 b, __m256 w) {
+    __m256 difference = _mm256_sub_ps(b, a);
+    __m256d low = smoothStepAVX2Half(_mm256_cvtps_pd(_mm256_castps256_ps128(a)), _mm256_cvtps_pd(_mm256_castps256_ps128(difference)), _mm256_cvtps_pd(_mm256_castps256_ps128(w)));
+    __m256d high = smoothStepAVX2Half(_mm256_cvtps_pd(_mm256_extractf128_ps(a, 1)), _mm256_cvtps_pd(_mm256_extractf128_ps(difference, 1)), _mm256_cvtps_pd(_mm256_extractf128_ps(w, 1)));
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(low)), _mm256_cvtpd_ps(high), 1);
+}
+
+__attribute__((target("avx2")))
+void noiseRowAVX2(float* out, const NoiseRow* row, int count, float dy0, float dy1) {
+    __m256 y0 = _mm256_set1_ps(dy0);
+    __m256 y1 = _mm256_set1_ps(dy1);
+    for(int i = 0; i < count; i += 8) {
+        __m256 dx0 = _mm256_loadu_ps(&row->dx0[i]);
+        __m256 dx1 = _mm256_loadu_ps(&row->dx1[i]);
+        __m256 c0 = _mm256_add_ps(_mm256_mul_ps(dx0, _mm256_loadu_ps(&row->g00x[i])), _mm256_mul_ps(y0, _mm256_loadu_ps(&row->g00y[i])));
+        __m256 c1 = _mm256_add_ps(_mm256_mul_ps(dx1, _mm256_loadu_ps(&row->g10x[i])), _mm256_mul_ps(y0, _mm256_loadu_ps(&row->g10y[i])));
+        __m256 c2 = _mm256_add_ps(_mm256_mul_ps(dx0, _mm256_loadu_ps(&row->g01x[i])), _mm256_mul_ps(y1, _mm256_loadu_ps(&row->g01y[i])));
+        __m256 c3 = _mm256_add_ps(_mm256_mul_ps(dx1, _mm256_loadu_ps(&row->g11x[i])), _mm256_mul_ps(y1, _mm256_loadu_ps(&row->g11y[i])));
+        __m256 val1 = smoothStepAVX2(c0, c1, dx0);
+        __m256 val2 = smoothStepAVX2(c2, c3, dx0);
+        _mm256_storeu_ps(&out[i], smoothStepAVX2(val1, val2, y0));
+    }
+}
+#endif
+
+// Looks up the corner gradients of every sample in the row, samples in the same cell as the one before copy its gradients
+void fillNoiseGradients(NoiseRow* row, const int* x0s, int count, int y0, int seed) {
+    for(int i = 0; i < count; i++) {
+        if(i > 0 && x0s[i] == x0s[i - 1]) {
+            row->g00x[i] = row->g00x[i - 1]; row->g00y[i] = row->g00y[i - 1];
+            row->g10x[i] = row->g10x[i - 1]; row->g10y[i] = row->g10y[i - 1];
+            row->g01x[i] = row->g01x[i - 1]; row->g01y[i] = row->g01y[i - 1];
+            row->g11x[i] = row->g11x[i - 1]; row->g11y[i] = row->g11y[i - 1];
+            continue;
+        }
+        vector2 g00, g01;
+        // Stepping into the next cell along means the old right edge is the new left edge
+        if(i > 0 && x0s[i] == x0s[i - 1] + 1) {
+            g00 = (vector2){ row->g10x[i - 1], row->g10y[i - 1] };
+            g01 = (vector2){ row->g11x[i - 1], row->g11y[i - 1] };
+        }
+        else {
+            g00 = randomGradient(x0s[i], y0, seed);
+            g01 = randomGradient(x0s[i], y0 + 1, seed);
+        }
+        vector2 g10 = randomGradient(x0s[i] + 1, y0, seed);
+        vector2 g11 = randomGradient(x0s[i] + 1, y0 + 1, seed);
+        row->g00x[i] = g00.x; row->g00y[i] = g00.y;
+        row->g10x[i] = g10.x; row->g10y[i] = g10.y;
+        row->g01x[i] = g01.x; row->g01y[i] = g01.y;
+        row->g11x[i] = g11.x; row->g11y[i] = g11.y;
+    }
+}
+
+// The SIMD kernels only take whole vectors, whatever is left over goes through the scalar kernel
+void noiseRow(float* out, const NoiseRow* row, int count, float dy0, float dy1) {
+    int done = 0;
+#ifdef NOISE_X86
+    if(noiseBackend == NOISE_AVX2) {
+        done = count & ~7;
+        noiseRowAVX2(out, row, done, dy0, dy1);
+    }
+    else if(noiseBackend == NOISE_SSE2) {
+        done = count & ~3;
+        noiseRowSSE2(out, row, done, dy0, dy1);
+    }
+#endif
+    noiseRowScalar(out, row, done, count, dy0, dy1);
+}
+
+// Fills out[j * width + i] with fractalNoise(scale, octaves, pers, lac, originX + i * step, originY + j * step, seed).
+// Each column is divided by the scale once and every octave reuses it, gradients are shared across a row
+// and the octaves are summed a whole row at a time.
+void fractalNoiseGrid(float* out, int width, int height, float originX, float originY, float step, float scale, int octaves, float pers, float lac, int seed) {
+    if(octaves <= 0) {
+        memset(out, 0, sizeof(float) * width * height);
+        return;
+    }
+    NoiseRow row;
+    int x0s[NOISE_TILE];
+    float baseX[NOISE_TILE];
+    float values[NOISE_TILE];
+    for(int tile = 0; tile < width; tile += NOISE_TILE) {
+        int count = width - tile < NOISE_TILE ? width - tile : NOISE_TILE;
+        for(int i = 0; i < count; i++) {
+            baseX[i] = (originX + (float)(tile + i) * step) / scale;
+        }
+        float amplitude = 1.0f;
+        float frequency = 1.0f;
+        float maxHeight = 0.0f;
+        for(int octave = 0; octave < octaves; octave++) {
+            for(int i = 0; i < count; i++) {
+                float x = baseX[i] * frequency;
+                x0s[i] = (int)floorf(x);
+                row.dx0[i] = x - (float)x0s[i];
+                row.dx1[i] = x - (float)(x0s[i] + 1);
+            }
+            // Rows only need new gradients once they cross into the next row of cells
+            int gradientRow = 0;
+            bool haveGradients = false;
+            for(int j = 0; j < height; j++) {
+                float y = ((originY + (float)j * step) / scale) * frequency;
+                int y0 = (int)floorf(y);
+                if(!haveGradients || y0 != gradientRow) {
+                    fillNoiseGradients(&row, x0s, count, y0, seed);
+                    gradientRow = y0;
+                    haveGradients = true;
+                }
+                noiseRow(values, &row, count, y - (float)y0, y - (float)(y0 + 1));
+                float* dst = out + j * width + tile;
+                if(octave == 0) {
+                    // Added to 0 like the sum in fractalNoise, so a sample of -0 comes out as 0 there too
+                    for(int i = 0; i < count; i++) {
+                        dst[i] = 0.0f + values[i] * amplitude;
+                    }
+                }
+                else {
+                    for(int i = 0; i < count; i++) {
+                        dst[i] += values[i] * amplitude;
+                    }
+                }
+            }
+            maxHeight += amplitude;
+            amplitude *= pers;
+            frequency *= lac;
+        }
+        for(int j = 0; j < height; j++) {
+            float* dst = out + j * width + tile;
+            for(int i = 0; i < count; i++) {
+                dst[i] /= maxHeight;
+            }
+        }
+    }
+}
+
+// 3D gradient noise for density based terrain. It always uses the permutation table and the twelve cube edge
+// gradients of improved Perlin noise, so only buildNoiseTable has to have run for the seed.
+
+#define NOISE3_GRADIENTS 16
+
+// The twelve edges of a cube, padded to sixteen by repeating four so the hash can be masked instead of divided
+const float noise3Gradients[NOISE3_GRADIENTS][3] = {
+    { 1,  1,  0}, {-1,  1,  0}, { 1, -1,  0}, {-1, -1,  0},
+    { 1,  0,  1}, {-1,  0,  1}, { 1,  0, -1}, {-1,  0, -1},
+    { 0,  1,  1}, { 0, -1,  1}, { 0,  1, -1}, { 0, -1, -1},
+    { 1,  1,  0}, {-1,  1,  0}, { 0, -1,  1}, { 0, -1, -1}
+};
+
+static inline const float* tableGradient3(int ix, int iy, int iz) {
+    int index = noiseTable.perm[noiseTable.perm[noiseTable.perm[ix & 255] + (iy & 255)] + (iz & 255)];
+    return noise3Gradients[index & (NOISE3_GRADIENTS - 1)];
+}
+
+// Quintic fade, its second derivative is zero at the lattice so the density has no creases along cell faces
+static inline float fade(float t) {
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+static inline float lerpf(float a, float b, float t) {
+    return a + t * (b - a);
+}
+
+static inline float gradientDot3(const float* grad, float dx, float dy, float dz) {
+    return grad[0] * dx + grad[1] * dy + grad[2] * dz;
+}
+
+// Roughly in [-1, 1], the seed is only used through the noise table
+float perlinNoise3(float x, float y, float z, int seed) {
+    (void)seed;
+    int x0 = (int)floorf(x);
+    int y0 = (int)floorf(y);
+    int z0 = (int)floorf(z);
+    float dx0 = x - (float)x0, dx1 = x - (float)(x0 + 1);
+    float dy0 = y - (float)y0, dy1 = y - (float)(y0 + 1);
+    float dz0 = z - (float)z0, dz1 = z - (float)(z0 + 1);
+    float u = fade(dx0);
+    float v = fade(dy0);
+    float w = fade(dz0);
+
+    // Corners are named by their x, y and z offset
+    float n000 = gradientDot3(tableGradient3(x0, y0, z0), dx0, dy0, dz0);
+    float n100 = gradientDot3(tableGradient3(x0 + 1, y0, z0), dx1, dy0, dz0);
+    float n010 = gradientDot3(tableGradient3(x0, y0 + 1, z0), dx0, dy1, dz0);
+    float n110 = gradientDot3(tableGradient3(x0 + 1, y0 + 1, z0), dx1, dy1, dz0);
+    float n001 = gradientDot3(tableGradient3(x0, y0, z0 + 1), dx0, dy0, dz1);
+    float n101 = gradientDot3(tableGradient3(x0 + 1, y0, z0 + 1), dx1, dy0, dz1);
+    float n011 = gradientDot3(tableGradient3(x0, y0 + 1, z0 + 1), dx0, dy1, dz1);
+    float n111 = gradientDot3(tableGradient3(x0 + 1, y0 + 1, z0 + 1), dx1, dy1, dz1);
+
+    float nx00 = lerpf(n000, n100, u);
+    float nx10 = lerpf(n010, n110, u);
+    float nx01 = lerpf(n001, n101, u);
+    float nx11 = lerpf(n011, n111, u);
+    return lerpf(lerpf(nx00, nx10, v), lerpf(nx01, nx11, v), w);
+}
+
+// One row of 3D samples along x. The corners are indexed by their offset as x | y << 1 | z << 2.
+typedef struct {
+    float dx0[NOISE_TILE];
+    float dx1[NOISE_TILE];
+    float u[NOISE_TILE]; // Faded x weight
+    float gx[8][NOISE_TILE], gy[8][NOISE_TILE], gz[8][NOISE_TILE];
+} NoiseRow3;
+
+// Offsets and weights shared by every sample in a row
+typedef struct {
+    float dy0, dy1, dz0, dz1;
+    float v, w;
+} NoiseRow3Offsets;
+
+void noiseRow3Scalar(float* out, const NoiseRow3* row, const NoiseRow3Offsets* o, int start, int count) {
+    for(int i = start; i < count; i++) {
+        float n[8];
+        for(int c = 0; c < 8; c++) {
+            float dx = c & 1 ? row->dx1[i] : row->dx0[i];
+            float dy = c & 2 ? o->dy1 : o->dy0;
+            float dz = c & 4 ? o->dz1 : o->dz0;
+            n[c] = row->gx[c][i] * dx + row->gy[c][i] * dy + row->gz[c][i] * dz;
+        }
+        float nx00 = lerpf(n[0], n[1], row->u[i]);
+        float nx10 = lerpf(n[2], n[3], row->u[i]);
+        float nx01 = lerpf(n[4], n[5], row->u[i]);
+        float nx11 = lerpf(n[6], n[7], row->u[i]);
+        out[i] = lerpf(lerpf(nx00, nx10, o->v), lerpf(nx01, nx11, o->v), o->w);
+    }
+}
+
+#ifdef NOISE_X86
+__attribute__((target("sse2")))
+static inline __m128 lerpSSE2(__m128 a, __m128 b, __m128 t) {
+    return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+
+__attribute__((target("sse2")))
+void noiseRow3SSE2(float* out, const NoiseRow3* row, const NoiseRow3Offsets* o, int count) {
+    __m128 dy[2] = {_mm_set1_ps(o->dy0), _mm_set1_ps(o->dy1)};
+    __m128 dz[2] = {_mm_set1_ps(o->dz0), _mm_set1_ps(o->dz1)};
+    __m128 v = _mm_set1_ps(o->v);
+    __m128 w = _mm_set1_ps(o->w);
+    for(int i = 0; i < count; i += 4) {
+        __m128 dx[2] = {_mm_loadu_ps(&row->dx0[i]), _mm_loadu_ps(&row->dx1[i])};
+        __m128 n[8];
+        for(int c = 0; c < 8; c++) {
+            __m128 xy = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&row->gx[c][i]), dx[c & 1]), _mm_mul_ps(_mm_loadu_ps(&row->gy[c][i]), dy[(c >> 1) & 1]));
+            n[c] = _mm_add_ps(xy, _mm_mul_ps(_mm_loadu_ps(&row->gz[c][i]), dz[c >> 2]));
+        }
+        __m128 u = _mm_loadu_ps(&row->u[i]);
+        __m128 y0 = lerpSSE2(lerpSSE2(n[0], n[1], u), lerpSSE2(n[2], n[3], u), v);
+        __m128 y1 = lerpSSE2(lerpSSE2(n[4], n[5], u), lerpSSE2(n[6], n[7], u), v);
+        _mm_storeu_ps(&out[i], lerpSSE2(y0, y1, w));
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256 lerpAVX2(__m256 a, __m256 b, __m256 t) {
+    return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+}
+
+__attribute__((target("avx2")))
+void noiseRow3AVX2(float* out, const NoiseRow3* row, const NoiseRow3Offsets* o, int count) {
+    __m256 dy[2] = {_mm256_set1_ps(o->dy0), _mm256_set1_ps(o->dy1)};
+    __m256 dz[2] = {_mm256_set1_ps(o->dz0), _mm256_set1_ps(o->dz1)};
+    __m256 v = _mm256_set1_ps(o->v);
+    __m256 w = _mm256_set1_ps(o->w);
+    for(int i = 0; i < count; i += 8) {
+        __m256 dx[2] = {_mm256_loadu_ps(&row->dx0[i]), _mm256_loadu_ps(&row->dx1[i])};
+        __m256 n[8];
+        for(int c = 0; c < 8; c++) {
+            __m256 xy = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(&row->gx[c][i]), dx[c & 1]), _mm256_mul_ps(_mm256_loadu_ps(&row->gy[c][i]), dy[(c >> 1) & 1]));
+            n[c] = _mm256_add_ps(xy, _mm256_mul_ps(_mm256_loadu_ps(&row->gz[c][i]), dz[c >> 2]));
+        }
+        __m256 u = _mm256_loadu_ps(&row->u[i]);
+        __m256 y0 = lerpAVX2(lerpAVX2(n[0], n[1], u), lerpAVX2(n[2], n[3], u), v);
+        __m256 y1 = lerpAVX2(lerpAVX2(n[4], n[5], u), lerpAVX2(n[6], n[7], u), v);
+        _mm256_storeu_ps(&out[i], lerpAVX2(y0, y1, w));
+    }
+}
+#endif
+
+void fillNoiseGradients3(NoiseRow3* row, const int* x0s, int count, int y0, int z0) {
+    for(int i = 0; i < count; i++) {
+        if(i > 0 && x0s[i] == x0s[i - 1]) {
+            for(int c = 0; c < 8; c++) {
+                row->gx[c][i] = row->gx[c][i - 1];
+                row->gy[c][i] = row->gy[c][i - 1];
+                row->gz[c][i] = row->gz[c][i - 1];
+            }
+            continue;
+        }
+        for(int c = 0; c < 8; c++) {
+            const float* grad = tableGradient3(x0s[i] + (c & 1), y0 + ((c >> 1) & 1), z0 + (c >> 2));
+            row->gx[c][i] = grad[0];
+            row->gy[c][i] = grad[1];
+            row->gz[c][i] = grad[2];
+        }
+    }
+}
+
+void noiseRow3(float* out, const NoiseRow3* row, const NoiseRow3Offsets* offsets, int count) {
+    int done = 0;
+#ifdef NOISE_X86
+    if(noiseBackend == NOISE_AVX2) {
+        done = count & ~7;
+        noiseRow3AVX2(out, row, offsets, done);
+    }
+    else if(noiseBackend == NOISE_SSE2) {
+        done = count & ~3;
+        noiseRow3SSE2(out, row, offsets, done);
+    }
+#endif
+    noiseRow3Scalar(out, row, offsets, done, count);
+}
+
+// Fills out[(k * height + j) * width + i] with perlinNoise3((originX + i * step) / scale, (originY + j * step) / scale,
+// (originZ + k * step) / scale, seed). A step above one samples a sparse lattice that callers interpolate between.
+void perlinNoise3Grid(float* out, int width, int height, int depth, float originX, float originY, float originZ, float step, float scale, int seed) {
+    (void)seed;
+    NoiseRow3 row;
+    int x0s[NOISE_TILE];
+    for(int tile = 0; tile < width; tile += NOISE_TILE) {
+        int count = width - tile < NOISE_TILE ? width - tile : NOISE_TILE;
+        for(int i = 0; i < count; i++) {
+            float x = (originX + (float)(tile + i) * step) / scale;
+            x0s[i] = (int)floorf(x);
+            row.dx0[i] = x - (float)x0s[i];
+            row.dx1[i] = x - (float)(x0s[i] + 1);
+            row.u[i] = fade(row.dx0[i]);
+        }
+        for(int k = 0; k < depth; k++) {
+            float z = (originZ + (float)k * step) / scale;
+            int z0 = (int)floorf(z);
+            int gradientRow = 0;
+            bool haveGradients = false;
+            for(int j = 0; j < height; j++) {
+                float y = (originY + (float)j * step) / scale;
+                int y0 = (int)floorf(y);
+                if(!haveGradients || y0 != gradientRow) {
+                    fillNoiseGradients3(&row, x0s, count, y0, z0);
+                    gradientRow = y0;
+                    haveGradients = true;
+                }
+                NoiseRow3Offsets offsets;
+                offsets.dy0 = y - (float)y0;
+                offsets.dy1 = y - (float)(y0 + 1);
+                offsets.dz0 = z - (float)z0;
+                offsets.dz1 = z - (float)(z0 + 1);
+                offsets.v = fade(offsets.dy0);
+                offsets.w = fade(offsets.dz0);
+                noiseRow3(out + (k * height + j) * width + tile, &row, &offsets, count);
+            }
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+// Queue comes from queue.h, which jobs.h includes ahead of this
+
+#define POOL_MIN_CLASS 12   // 4 KB
+#define POOL_MAX_CLASS 22   // 4 MB, the largest class still caches two blocks within POOL_CLASS_BYTES
+#define POOL_CLASS_COUNT (POOL_MAX_CLASS - POOL_MIN_CLASS + 1)
+#define POOL_CLASS_BYTES (8 * 1024 * 1024) // Upper bound on the memory cached by each size class
+
+// Power of two size classes, each with a lock-free free list so blocks can be allocated on worker threads
+// and returned on the render thread without either side taking a lock. Requests larger than the biggest class
+// go straight to malloc.
+typedef struct {
+    Queue freeBlocks[POOL_CLASS_COUNT];
+    long reused;
+    long allocated;
+} Pool;
+
+int poolClass(size_t bytes) {
+    int sizeClass = POOL_MIN_CLASS;
+    while(sizeClass <= POOL_MAX_CLASS && ((size_t)1 << sizeClass) < bytes) {
+        sizeClass++;
+    }
+    return sizeClass - POOL_MIN_CLASS;
+}
+
+bool createPool(Pool* pool) {
+    for(int i = 0; i < POOL_CLASS_COUNT; i++) {
+        if(!createQueue(&pool->freeBlocks[i], POOL_CLASS_BYTES >> (i + POOL_MIN_CLASS))) {
+            return false;
+        }
+    }
+    pool->reused = 0;
+    pool->allocated = 0;
+    return true;
+}
+
+void destroyPool(Pool* pool) {
+    for(int i = 0; i < POOL_CLASS_COUNT; i++) {
+        void* block;
+        while((block = dequeue(&pool->freeBlocks[i]))) {
+            free(block);
+        }
+        destroyQueue(&pool->freeBlocks[i]);
+    }
+}
+
+void* poolAlloc(Pool* pool, size_t bytes) {
+    if(bytes == 0) {
+        return NULL;
+    }
+    int sizeClass = poolClass(bytes);
+    if(sizeClass >= POOL_CLASS_COUNT) {
+        return malloc(bytes);
+    }
+    void* block = dequeue(&pool->freeBlocks[sizeClass]);
+    if(block) {
+        __atomic_fetch_add(&pool->reused, 1, __ATOMIC_RELAXED);
+        return block;
+    }
+    __atomic_fetch_add(&pool->allocated, 1, __ATOMIC_RELAXED);
+    return malloc((size_t)1 << (sizeClass + POOL_MIN_CLASS));
+}
+
+// bytes has to be the size the block was allocated with so it lands back in the same class
+void poolFree(Pool* pool, void* block, size_t bytes) {
+    if(!block) {
+        return;
+    }
+    int sizeClass = poolClass(bytes);
+    if(sizeClass >= POOL_CLASS_COUNT || !enqueue(&pool->freeBlocks[sizeClass], block)) {
+        free(block);
+    }
+}
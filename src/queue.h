@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sched.h>
+
+#define CACHE_LINE 64
+
+// Bounded multi-producer/multi-consumer queue, each cell carries a sequence number that tells
+// producers and consumers whose turn it is so no locks are needed (Dmitry Vyukov's design)
+typedef struct {
+    size_t sequence;
+    void* data;
+} QueueCell;
+
+typedef struct {
+    QueueCell* cells;
+    size_t mask;
+    char pad0[CACHE_LINE];
+    size_t enqueuePos;
+    char pad1[CACHE_LINE];
+    size_t dequeuePos;
+    char pad2[CACHE_LINE];
+} Queue;
+
+// The capacity is rounded up to a power of two so positions can wrap with a mask
+bool createQueue(Queue* queue, int capacity) {
+    size_t size = 2;
+    while(size < (size_t)capacity) {
+        size <<= 1;
+    }
+    queue->cells = (QueueCell*)malloc(sizeof(QueueCell) * size);
+    if(!queue->cells) {
+        fprintf(stderr, "Failed to allocate a queue of %d elements!\n", capacity);
+        return false;
+    }
+    queue->mask = size - 1;
+    for(size_t i = 0; i < size; i++) {
+        queue->cells[i].sequence = i;
+        queue->cells[i].data = NULL;
+    }
+    queue->enqueuePos = 0;
+    queue->dequeuePos = 0;
+    return true;
+}
+
+void destroyQueue(Queue* queue) {
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+// Returns false instead of waiting when the queue is full
+bool enqueue(Queue* queue, void* data) {
+    QueueCell* cell;
+    size_t pos = __atomic_load_n(&queue->enqueuePos, __ATOMIC_RELAXED);
+    while(1) {
+        cell = &queue->cells[pos & queue->mask];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&queue->enqueuePos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        else if(diff < 0) {
+            return false;
+        }
+        else {
+            pos = __atomic_load_n(&queue->enqueuePos, __ATOMIC_RELAXED);
+        }
+    }
+    cell->data = data;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Returns NULL instead of waiting when the queue is empty
+void* dequeue(Queue* queue) {
+    QueueCell* cell;
+    size_t pos = __atomic_load_n(&queue->dequeuePos, __ATOMIC_RELAXED);
+    while(1) {
+        cell = &queue->cells[pos & queue->mask];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&queue->dequeuePos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        else if(diff < 0) {
+            return NULL;
+        }
+        else {
+            pos = __atomic_load_n(&queue->dequeuePos, __ATOMIC_RELAXED);
+        }
+    }
+    void* data = cell->data;
+    __atomic_store_n(&cell->sequence, pos + queue->mask + 1, __ATOMIC_RELEASE);
+    return data;
+}
+
+// Used by worker threads, if the consumer falls behind they yield rather than dropping the element
+void enqueueWait(Queue* queue, void* data) {
+    while(!enqueue(queue, data)) {
+        sched_yield();
+    }
+}
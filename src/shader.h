@@ -1,15 +1,93 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <cglm/cglm.h>
+#include <string.h>
 
-void setFloat(unsigned int shaderProgram, const char* location, float val) {
-    int uniformLocation = glGetUniformLocation(shaderProgram, location);
-	glUniform1f(uniformLocation, val);
+typedef struct {
+	char* name;
+	GLint location;
+} ShaderUniform;
+
+// A linked program and the locations of its uniforms, looked up once when it is created so setting a uniform
+// never goes through glGetUniformLocation. Uniforms inside blocks have no location and are not in the table.
+typedef struct {
+	GLuint program; // 0 when the shader failed to build
+	ShaderUniform* uniforms; // Sorted by name
+	int uniformCount;
+} Shader;
+
+int compareShaderUniforms(const void* a, const void* b) {
+	return strcmp(((const ShaderUniform*)a)->name, ((const ShaderUniform*)b)->name);
+}
+
+void cacheUniformLocations(Shader* shader) {
+	GLint count, maxLength;
+	glGetProgramiv(shader->program, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(shader->program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	shader->uniforms = (ShaderUniform*)malloc(sizeof(ShaderUniform) * (count ? count : 1));
+	shader->uniformCount = 0;
+	if(!shader->uniforms) {
+		fprintf(stderr, "Failed to allocate the uniform table!\n");
+		return;
+	}
+	for(GLint i = 0; i < count; i++) {
+		char* name = (char*)malloc(maxLength);
+		if(!name) {
+			fprintf(stderr, "Failed to allocate a uniform name!\n");
+			break;
+		}
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(shader->program, (GLuint)i, maxLength, NULL, &size, &type, name);
+		GLint location = glGetUniformLocation(shader->program, name);
+		if(location < 0) {
+			free(name);
+			continue;
+		}
+		shader->uniforms[shader->uniformCount++] = (ShaderUniform){name, location};
+	}
+	qsort(shader->uniforms, shader->uniformCount, sizeof(ShaderUniform), compareShaderUniforms);
+}
+
+// -1 for names the program does not use, which glUniform ignores just like it would from glGetUniformLocation
+GLint getUniformLocation(const Shader* shader, const char* name) {
+	ShaderUniform key = {(char*)name, 0};
+	ShaderUniform* found = (ShaderUniform*)bsearch(&key, shader->uniforms, shader->uniformCount, sizeof(ShaderUniform), compareShaderUniforms);
+	return found ? found->location : -1;
+}
+
+void destroyShader(Shader* shader) {
+	for(int i = 0; i < shader->uniformCount; i++) {
+		free(shader->uniforms[i].name);
+	}
+	free(shader->uniforms);
+	glDeleteProgram(shader->program);
+	memset(shader, 0, sizeof(Shader));
 }
 
-void setVec3(unsigned int shaderProgram, const char* location, vec3 val) {
-    int uniformLocation = glGetUniformLocation(shaderProgram, location);
-	glUniform3f(uniformLocation, val[0], val[1], val[2]);
+void setInt(const Shader* shader, const char* name, int val) {
+	glUniform1i(getUniformLocation(shader, name), val);
+}
+
+void setFloat(const Shader* shader, const char* name, float val) {
+	glUniform1f(getUniformLocation(shader, name), val);
+}
+
+// Uniform blocks pick their binding in the shader, so the buffer only has to be bound to the same index once
+GLuint createUniformBuffer(GLuint binding, GLsizeiptr size) {
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	return buffer;
+}
+
+void updateUniformBuffer(GLuint buffer, const void* data, GLsizeiptr size) {
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
 char* readShaderSource(const char* path) {
@@ -29,7 +107,9 @@ char* readShaderSource(const char* path) {
 	return content;
 }
 
-unsigned int createShader(const char* pathVs, const char* pathFs) {
+// Returns a shader with a program of 0 if it failed to compile or link
+Shader createShader(const char* pathVs, const char* pathFs) {
+	Shader shader = {0, NULL, 0};
 	unsigned int vsShader, fsShader;
 	vsShader = glCreateShader(GL_VERTEX_SHADER);
 	fsShader = glCreateShader(GL_FRAGMENT_SHADER);
@@ -53,7 +133,7 @@ unsigned int createShader(const char* pathVs, const char* pathFs) {
 		fprintf(stderr, "Shader failed to compile! Vertex Shader error:\n%s", log);
 		glDeleteShader(vsShader);
 		free(log);
-		return 0;
+		return shader;
 	}
 	glCompileShader(fsShader);
 	glGetShaderiv(fsShader, GL_COMPILE_STATUS, &success);
@@ -65,7 +145,7 @@ unsigned int createShader(const char* pathVs, const char* pathFs) {
 		fprintf(stderr, "Shader failed to compile! Fragment Shader error:\n%s", log);
 		glDeleteShader(fsShader);
 		free(log);
-		return 0;
+		return shader;
 	}
 	unsigned int shaderProgram;
 	shaderProgram = glCreateProgram();
@@ -84,11 +164,13 @@ unsigned int createShader(const char* pathVs, const char* pathFs) {
 		fprintf(stderr, "Failed to link shader program! Error:\n%s", log);
 		glDeleteProgram(shaderProgram);
 		free(log);
-		return 0;
+		return shader;
 	}
 	glDetachShader(shaderProgram, vsShader);
 	glDetachShader(shaderProgram, fsShader);
 	glDeleteShader(vsShader);
 	glDeleteShader(fsShader);
-	return shaderProgram;
-}
\ No newline at end of file
+	shader.program = shaderProgram;
+	cacheUniformLocations(&shader);
+	return shader;
+}
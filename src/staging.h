@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define STAGING_BYTES (16 * 1024 * 1024)
+#define STAGING_RECORDS 4096 // Allocations that can be live at once, a power of two
+#define STAGING_FENCES 16    // Frames of copies that can be waiting on the GPU at once
+
+// One allocation, in the order they were made. Positions only ever grow, the offset in the buffer is the position
+// modulo the ring size.
+typedef struct {
+    long start;
+    long end;
+    long frame; // Frame whose fence has to pass before the space can be reused, -1 while it is still in use
+} StagingRecord;
+
+typedef struct {
+    GLsync sync;
+    long frame;
+} StagingFence;
+
+// A persistently mapped buffer that workers write finished meshes straight into and the render thread copies
+// out of on the GPU. Space is handed out in order and comes back in order once the fence of the frame that
+// released it has passed, so a mesh is never overwritten while a copy may still be reading it.
+// Workers only advance head and nextRecord, the render thread only advances tail and firstRecord, so the render
+// thread gives space back without locking.
+typedef struct {
+    GLuint buffer;
+    char* memory; // NULL when the ring could not be created, meshes then stay in the vertex pool
+    long size;
+    long head;
+    long tail;
+    StagingRecord records[STAGING_RECORDS];
+    unsigned int firstRecord; // Positions only grow, the slot is the position masked by STAGING_RECORDS - 1
+    unsigned int nextRecord;
+    StagingFence fences[STAGING_FENCES];
+    int firstFence;
+    int fenceCount;
+    long frame;          // Frame that releases are currently being collected for
+    long completedFrame; // Last frame whose fence has passed
+    bool released;       // Something was released since the last fence
+    pthread_mutex_t mutex; // Only taken by workers, to allocate one at a time
+    long staged;
+    long overflowed;     // Meshes that did not fit and went to the vertex pool instead
+} StagingRing;
+
+StagingRing stagingRing;
+
+bool createStagingRing(StagingRing* ring, long size) {
+    memset(ring, 0, sizeof(StagingRing));
+    ring->completedFrame = -1;
+    pthread_mutex_init(&ring->mutex, NULL);
+    if(!glad_glBufferStorage) {
+        fprintf(stderr, "OpenGL 4.4 buffer storage is not supported, meshes are uploaded without the staging ring\n");
+        return false;
+    }
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &ring->buffer);
+    glBindBuffer(GL_COPY_READ_BUFFER, ring->buffer);
+    glBufferStorage(GL_COPY_READ_BUFFER, size, NULL, flags);
+    ring->memory = (char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, size, flags);
+    if(!ring->memory) {
+        fprintf(stderr, "Failed to map the staging ring, meshes are uploaded without it\n");
+        glDeleteBuffers(1, &ring->buffer);
+        ring->buffer = 0;
+        return false;
+    }
+    ring->size = size;
+    return true;
+}
+
+void destroyStagingRing(StagingRing* ring) {
+    while(ring->fenceCount > 0) {
+        glDeleteSync(ring->fences[ring->firstFence].sync);
+        ring->firstFence = (ring->firstFence + 1) % STAGING_FENCES;
+        ring->fenceCount--;
+    }
+    if(ring->buffer) {
+        // Deleting the buffer also unmaps it
+        glDeleteBuffers(1, &ring->buffer);
+    }
+    pthread_mutex_destroy(&ring->mutex);
+    memset(ring, 0, sizeof(StagingRing));
+}
+
+// Called on the worker threads. Returns the memory and sets the record to give back once it has been copied,
+// or NULL when the ring is full so the caller can fall back to the vertex pool.
+void* allocateStaging(StagingRing* ring, long bytes, int* record) {
+    if(!ring->memory || bytes == 0 || bytes > ring->size / 2) {
+        return NULL;
+    }
+    void* memory = NULL;
+    pthread_mutex_lock(&ring->mutex);
+    long start = ring->head;
+    // Allocations never wrap around the end of the buffer, the space left there is skipped
+    if(start % ring->size + bytes > ring->size) {
+        start += ring->size - start % ring->size;
+    }
+    long tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    unsigned int firstRecord = __atomic_load_n(&ring->firstRecord, __ATOMIC_ACQUIRE);
+    if(start + bytes - tail <= ring->size && ring->nextRecord - firstRecord < STAGING_RECORDS) {
+        *record = (int)(ring->nextRecord & (STAGING_RECORDS - 1));
+        ring->records[*record] = (StagingRecord){start, start + bytes, -1};
+        // Publishes the record to the render thread
+        __atomic_store_n(&ring->nextRecord, ring->nextRecord + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&ring->head, start + bytes, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&ring->staged, 1, __ATOMIC_RELAXED);
+        memory = ring->memory + start % ring->size;
+    }
+    else {
+        __atomic_add_fetch(&ring->overflowed, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&ring->mutex);
+    return memory;
+}
+
+// Offset of memory from allocateStaging in the staging buffer, for copying out of it
+GLintptr stagingOffset(StagingRing* ring, const void* memory) {
+    return (GLintptr)((const char*)memory - ring->memory);
+}
+
+// Called on the render thread once nothing still needs the memory on the CPU. Any copy out of it issued before
+// the end of the frame is covered by that frame's fence.
+void releaseStaging(StagingRing* ring, int record) {
+    // Workers never touch a record again once it is published, only the render thread reads the frame
+    ring->records[record].frame = ring->frame;
+    ring->released = true;
+}
+
+// Checks the fences without waiting and gives back the space of every frame the GPU has finished with
+void retireStaging(StagingRing* ring) {
+    while(ring->fenceCount > 0) {
+        StagingFence* fence = &ring->fences[ring->firstFence];
+        GLenum status = glClientWaitSync(fence->sync, 0, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            break;
+        }
+        glDeleteSync(fence->sync);
+        ring->completedFrame = fence->frame;
+        ring->firstFence = (ring->firstFence + 1) % STAGING_FENCES;
+        ring->fenceCount--;
+    }
+    unsigned int nextRecord = __atomic_load_n(&ring->nextRecord, __ATOMIC_ACQUIRE);
+    unsigned int firstRecord = ring->firstRecord;
+    long tail = ring->tail;
+    while(firstRecord != nextRecord) {
+        StagingRecord* record = &ring->records[firstRecord & (STAGING_RECORDS - 1)];
+        if(record->frame < 0 || record->frame > ring->completedFrame) {
+            break;
+        }
+        tail = record->end;
+        firstRecord++;
+    }
+    // Hands the space back to the workers
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->firstRecord, firstRecord, __ATOMIC_RELEASE);
+}
+
+// Fences the copies issued this frame if anything was released, the space comes back once the fence passes
+void endStagingFrame(StagingRing* ring) {
+    if(!ring->released) {
+        return;
+    }
+    if(ring->fenceCount == STAGING_FENCES) {
+        // Only happens when the GPU is this many frames behind, waiting on the oldest frame frees its slot
+        GLenum status;
+        do {
+            status = glClientWaitSync(ring->fences[ring->firstFence].sync, GL_SYNC_FLUSH_COMMANDS_BIT, (GLuint64)1000000000);
+        } while(status == GL_TIMEOUT_EXPIRED);
+        retireStaging(ring);
+        if(ring->fenceCount == STAGING_FENCES) {
+            return;
+        }
+    }
+    int slot = (ring->firstFence + ring->fenceCount) % STAGING_FENCES;
+    ring->fences[slot].sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ring->fences[slot].frame = ring->frame;
+    ring->fenceCount++;
+    // Only the render thread reads these
+    ring->frame++;
+    ring->released = false;
+}
+
+void printStagingStats(StagingRing* ring) {
+    if(!ring->memory) {
+        return;
+    }
+    printf("Staging ring: %.1f MB, %.1f MB in use, %ld meshes staged, %ld went to the vertex pool\n", ring->size / (1024.0 * 1024.0),
+        (__atomic_load_n(&ring->head, __ATOMIC_RELAXED) - ring->tail) / (1024.0 * 1024.0),
+        __atomic_load_n(&ring->staged, __ATOMIC_RELAXED), __atomic_load_n(&ring->overflowed, __ATOMIC_RELAXED));
+}
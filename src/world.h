@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <cglm/cglm.h>
+#include "chunkmap.h"
+
+typedef struct {
+    int cx, cz;
+    ChunkJobStage stage;
+    float priority;
+} ChunkCandidate;
+
+typedef struct {
+    Chunk* chunks;  // Pool of chunk slots, loaded chunks are found through the map
+    ChunkSection* sections; // sectionCount sections for every slot
+    int sectionCount;       // Height of the world in sections
+    ChunkJob* jobs;
+    ChunkMap map;
+    int* freeSlots;
+    int freeCount;
+    int slotCount;
+    ChunkCandidate* candidates;
+    int radius;     // Chunks within this many chunks of the camera are drawn, data is generated one ring further out
+    int centerX, centerZ;
+    int seed;
+    TerrainProfile profile;
+    int inFlight;
+    int maxInFlight;
+    Queue completed;
+    WorkerStats* stats;
+    MeshScratch* scratch;
+    int workerCount;
+    int chunksBuilt;
+    int sectionsEmpty;    // Sections skipped without meshing since the last stats were printed
+    int sectionsOccluded;
+    long verticesBuilt;
+    double uploadTime;
+    float loadStart;
+} World;
+
+World world;
+
+// Returns the chunk at the given chunk coordinate, or NULL if it is not loaded
+Chunk* getChunk(World* world, int cx, int cz) {
+    int slot = chunkMapFind(&world->map, cx, cz);
+    return slot == -1 ? NULL : &world->chunks[slot];
+}
+
+// Chunk columns only have the four side neighbours, sections above and below are in the same column
+Chunk* getNeighbour(World* world, int cx, int cz, Face face) {
+    int n = faceAxis[face];
+    if(n == 1) {
+        return NULL;
+    }
+    return getChunk(world, cx + (n == 0 ? faceDirection[face] : 0), cz + (n == 2 ? faceDirection[face] : 0));
+}
+
+// Chunks are kept until they are one chunk past the data radius so moving back and forth over a chunk border does not thrash
+bool chunkInRange(World* world, int cx, int cz) {
+    int dx = cx - world->centerX;
+    int dz = cz - world->centerZ;
+    int keep = world->radius + 2;
+    return dx * dx + dz * dz <= keep * keep;
+}
+
+// Every chunk within the keep radius plus the ones still being built after they left it
+int countWorldSlots(int radius, int maxInFlight) {
+    int keep = radius + 2;
+    int count = 0;
+    for (int dx = -keep; dx <= keep; dx++) {
+        for (int dz = -keep; dz <= keep; dz++) {
+            if(dx * dx + dz * dz <= keep * keep) {
+                count++;
+            }
+        }
+    }
+    return count + maxInFlight;
+}
+
+bool createWorld(World* world, int radius, int sectionCount, int seed, int workerCount, TerrainProfile profile) {
+    if(profile.sampleStep < 1 || CHUNK_SIZE % profile.sampleStep != 0) {
+        fprintf(stderr, "The terrain sample step has to divide the chunk size (%d)!\n", CHUNK_SIZE);
+        return false;
+    }
+    world->radius = radius;
+    world->sectionCount = sectionCount;
+    world->profile = profile;
+    world->centerX = 0;
+    world->centerZ = 0;
+    world->seed = seed;
+    buildNoiseTable(seed);
+    world->inFlight = 0;
+    // Only a couple of jobs per worker are queued at once so the priority order keeps up with the camera
+    world->maxInFlight = workerCount * 2 < JOB_CAPACITY ? workerCount * 2 : JOB_CAPACITY;
+    world->workerCount = workerCount;
+    world->chunksBuilt = 0;
+    world->sectionsEmpty = 0;
+    world->sectionsOccluded = 0;
+    world->verticesBuilt = 0;
+    world->uploadTime = 0.0;
+    int slots = countWorldSlots(radius, world->maxInFlight);
+    world->slotCount = slots;
+    world->chunks = (Chunk*)calloc(slots, sizeof(Chunk));
+    world->sections = (ChunkSection*)calloc((size_t)slots * sectionCount, sizeof(ChunkSection));
+    world->jobs = (ChunkJob*)malloc(sizeof(ChunkJob) * slots);
+    world->freeSlots = (int*)malloc(sizeof(int) * slots);
+    world->candidates = (ChunkCandidate*)malloc(sizeof(ChunkCandidate) * (2 * radius + 3) * (2 * radius + 3));
+    world->stats = (WorkerStats*)calloc(workerCount, sizeof(WorkerStats));
+    world->scratch = (MeshScratch*)calloc(workerCount, sizeof(MeshScratch));
+    if(!world->scratch || !createPool(&vertexPool) || !createPool(&blockPool)) {
+        fprintf(stderr, "Failed to allocate the world!\n");
+        return false;
+    }
+    for (int i = 0; i < workerCount; i++) {
+        if(!createMeshScratch(&world->scratch[i])) {
+            return false;
+        }
+    }
+    if(!world->chunks || !world->sections || !world->jobs || !world->freeSlots || !world->candidates || !world->stats
+        || !createChunkMap(&world->map, slots) || !createQueue(&world->completed, world->maxInFlight)
+        || !createMeshBuffer(&meshBuffer, world->sections, slots * sectionCount)) {
+        fprintf(stderr, "Failed to allocate the world!\n");
+        return false;
+    }
+    // Without the ring meshes are still uploaded, just from the vertex pool on the render thread
+    createStagingRing(&stagingRing, STAGING_BYTES);
+    world->freeCount = 0;
+    for (int i = slots - 1; i >= 0; i--) {
+        world->freeSlots[world->freeCount++] = i;
+        world->chunks[i].sections = &world->sections[i * sectionCount];
+        world->chunks[i].sectionCount = sectionCount;
+        for (int j = 0; j < sectionCount; j++) {
+            world->chunks[i].sections[j].id = i * sectionCount + j;
+            world->chunks[i].sections[j].stagingRecord = -1;
+        }
+    }
+    size_t slotBytes = sizeof(Chunk) + sizeof(ChunkSection) * sectionCount;
+    printf("World streaming %d chunk slots, %d sections tall (%.1f MB before block storage)\n", slots, sectionCount, slots * slotBytes / (1024.0 * 1024.0));
+    return true;
+}
+
+void printGenerationStats(World* world) {
+    double dataTime = 0.0, meshTime = 0.0;
+    for (int i = 0; i < world->workerCount; i++) {
+        dataTime += world->stats[i].dataTime;
+        meshTime += world->stats[i].meshTime;
+    }
+    printf("\nWorker threads: %d\n", world->workerCount);
+    printf("Chunks built: %d (%s meshing, %ld vertices)\n", world->chunksBuilt, meshMode == MESH_GREEDY ? "greedy" : "naive", world->verticesBuilt);
+    printf("Sections skipped: %d empty, %d occluded\n", world->sectionsEmpty, world->sectionsOccluded);
+    printf("Chunk data: %f (summed over workers)\n", dataTime);
+    printf("Chunk mesh: %f (summed over workers)\n", meshTime);
+    printf("Upload: %f\n", world->uploadTime);
+    printMeshBufferStats(&meshBuffer);
+    printStagingStats(&stagingRing);
+    long scratchBytes = 0;
+    for (int i = 0; i < world->workerCount; i++) {
+        scratchBytes += sizeof(Vertex) * world->scratch[i].capacity + sizeof(uint16_t) * PALETTE_VOLUME;
+    }
+    printf("Mesh scratch: %ld KB, vertex arrays reused: %ld, allocated: %ld\n", scratchBytes / 1024, vertexPool.reused, vertexPool.allocated);
+    int stored = 0, uniform = 0;
+    size_t storedBytes = 0;
+    for (int i = 0; i < world->slotCount; i++) {
+        Chunk* chunk = &world->chunks[i];
+        if(!chunkHasData(chunk)) {
+            continue;
+        }
+        for (int j = 0; j < chunk->sectionCount; j++) {
+            stored++;
+            uniform += isUniformStorage(&chunk->sections[j].storage);
+            storedBytes += sizeof(ChunkSection) + blockStorageBytes(&chunk->sections[j].storage);
+        }
+    }
+    if(stored) {
+        printf("Block storage: %d sections (%d uniform), %.0f bytes per section against %d dense\n", stored, uniform,
+            (double)storedBytes / stored, (int)(sizeof(ChunkSection) - sizeof(BlockStorage) + sizeof(uint16_t) * PALETTE_VOLUME));
+    }
+    printf("Time taken: %f\n", glfwGetTime() - world->loadStart);
+    memset(world->stats, 0, sizeof(WorkerStats) * world->workerCount);
+    world->chunksBuilt = 0;
+    world->sectionsEmpty = 0;
+    world->sectionsOccluded = 0;
+    world->verticesBuilt = 0;
+    world->uploadTime = 0.0;
+}
+
+// Generates the same chunks at every sample step that divides the chunk size and compares them against a step of one,
+// showing how much of the terrain changes against how much time and noise sampling it saves
+void printSamplingReport(const TerrainProfile* profile, int seed, int chunkCount, int sectionCount) {
+    // Dense block arrays, compressing them would only add the same cost to every step
+    uint16_t* exact = (uint16_t*)malloc(sizeof(uint16_t) * PALETTE_VOLUME * chunkCount);
+    uint16_t* sparse = (uint16_t*)malloc(sizeof(uint16_t) * PALETTE_VOLUME);
+    bool* surface = (bool*)malloc(sizeof(bool) * chunkCount);
+    if(!exact || !sparse || !surface) {
+        fprintf(stderr, "Failed to allocate chunks for the sampling report!\n");
+        free(exact);
+        free(sparse);
+        free(surface);
+        return;
+    }
+    printf("\nSampling report (%s terrain, %d sections)\n", terrainModeNames[profile->mode], chunkCount);
+    printf("Step  Samples/section  Time/section (ms)  Blocks changed\n");
+    int surfaceCount = 0;
+    for(int step = 1; step <= CHUNK_SIZE / 4; step *= 2) {
+        TerrainProfile stepped = *profile;
+        stepped.sampleStep = step;
+        int points = CHUNK_SIZE / step + 1;
+        long samples = (long)points * points * profile->octaves;
+        if(profile->mode == TERRAIN_DENSITY) {
+            samples += (long)points * points * points;
+        }
+        long changed = 0;
+        double time = 0.0;
+        for(int i = 0; i < chunkCount; i++) {
+            // Sections are spread out along a diagonal and up the columns so they cover different terrain
+            vec3 pos = {i * 7 * CHUNK_SIZE, (i % sectionCount) * CHUNK_SIZE, -i * 5 * CHUNK_SIZE};
+            uint16_t* blocks = step == 1 ? exact + i * PALETTE_VOLUME : sparse;
+            double start = glfwGetTime();
+            generateTerrain((uint16_t (*)[CHUNK_SIZE][CHUNK_SIZE])blocks, pos, &stepped, seed);
+            time += glfwGetTime() - start;
+            if(step == 1) {
+                // Sections of one block type are all air or all ground and would only water the error down
+                surface[i] = false;
+                for(int j = 1; j < PALETTE_VOLUME && !surface[i]; j++) {
+                    surface[i] = blocks[j] != blocks[0];
+                }
+                surfaceCount += surface[i];
+                continue;
+            }
+            if(!surface[i]) {
+                continue;
+            }
+            for(int j = 0; j < PALETTE_VOLUME; j++) {
+                changed += exact[i * PALETTE_VOLUME + j] != sparse[j];
+            }
+        }
+        printf("%4d  %15ld  %17.3f  %13.3f%%\n", step, samples, time * 1000.0 / chunkCount,
+            surfaceCount ? 100.0 * changed / ((double)surfaceCount * PALETTE_VOLUME) : 0.0);
+    }
+    printf("Blocks changed is over the %d sections holding the surface\n", surfaceCount);
+    free(exact);
+    free(sparse);
+    free(surface);
+}
+
+// Throws away every loaded chunk, the streaming code then rebuilds the area around the camera with the new seed
+void resetWorld(World* world, JobSystem* jobs, int seed) {
+    // Workers may still be building chunks, they have to finish before the slots are reused
+    waitForJobs(jobs);
+    while(dequeue(&world->completed)) {}
+    world->inFlight = 0;
+    world->freeCount = 0;
+    for (int i = world->slotCount - 1; i >= 0; i--) {
+        unloadChunk(&world->chunks[i]);
+        world->freeSlots[world->freeCount++] = i;
+    }
+    clearChunkMap(&world->map);
+    world->seed = seed;
+    buildNoiseTable(seed);
+}
+
+void destroyWorld(World* world, JobSystem* jobs) {
+    resetWorld(world, jobs, world->seed);
+    destroyQueue(&world->completed);
+    destroyChunkMap(&world->map);
+    free(world->chunks);
+    free(world->sections);
+    free(world->jobs);
+    free(world->freeSlots);
+    free(world->candidates);
+    free(world->stats);
+    for (int i = 0; i < world->workerCount; i++) {
+        destroyMeshScratch(&world->scratch[i]);
+    }
+    free(world->scratch);
+    destroyPool(&vertexPool);
+    destroyPool(&blockPool);
+    destroyMeshBuffer(&meshBuffer);
+    destroyStagingRing(&stagingRing);
+}
+
+int compareCandidates(const void* a, const void* b) {
+    float pa = ((const ChunkCandidate*)a)->priority;
+    float pb = ((const ChunkCandidate*)b)->priority;
+    return (pa > pb) - (pa < pb);
+}
+
+// Lower is sooner, distance from the camera scaled up for chunks behind it
+float chunkPriority(int cx, int cz, vec3 cameraPos, vec3 cameraFront) {
+    float dx = (cx + 0.5f) - cameraPos[0] / CHUNK_SIZE;
+    float dz = (cz + 0.5f) - cameraPos[2] / CHUNK_SIZE;
+    float distance = sqrtf(dx * dx + dz * dz);
+    float frontLength = sqrtf(cameraFront[0] * cameraFront[0] + cameraFront[2] * cameraFront[2]);
+    if(distance < 0.001f || frontLength < 0.001f) {
+        return distance;
+    }
+    float facing = (dx * cameraFront[0] + dz * cameraFront[2]) / (distance * frontLength);
+    return distance * (2.0f - facing);
+}
+
+void releaseChunk(World* world, Chunk* chunk) {
+    chunkMapRemove(&world->map, chunk->cx, chunk->cz);
+    unloadChunk(chunk);
+    world->freeSlots[world->freeCount++] = (int)(chunk - world->chunks);
+}
+
+// Moves finished chunks onto the GPU until about budget bytes of vertices have been uploaded this frame,
+// a chunk is never split so the last one can go over
+void uploadCompletedChunks(World* world, long budget) {
+    retireStaging(&stagingRing);
+    Chunk* chunk;
+    long uploaded = 0;
+    while (uploaded < budget && (chunk = (Chunk*)dequeue(&world->completed))) {
+        world->inFlight--;
+        // The camera may have moved away while the chunk was being built
+        if(!chunkInRange(world, chunk->cx, chunk->cz)) {
+            releaseChunk(world, chunk);
+            continue;
+        }
+        if(chunk->state == CHUNK_GENERATING) {
+            chunk->state = CHUNK_HAS_DATA;
+            continue;
+        }
+        double uploadStart = glfwGetTime();
+        uploadChunkToGPU(chunk);
+        world->uploadTime += glfwGetTime() - uploadStart;
+        // The CPU copy of the mesh is not needed once it is on the GPU
+        freeChunkVertices(chunk);
+        world->chunksBuilt++;
+        world->verticesBuilt += chunkVertexCount(chunk);
+        uploaded += sizeof(Vertex) * chunkVertexCount(chunk);
+    }
+    endStagingFrame(&stagingRing);
+}
+
+void evictChunks(World* world) {
+    for (int i = 0; i < world->slotCount; i++) {
+        Chunk* chunk = &world->chunks[i];
+        bool idle = chunk->state == CHUNK_HAS_DATA || chunk->state == CHUNK_READY;
+        if(idle && !chunkInRange(world, chunk->cx, chunk->cz)) {
+            releaseChunk(world, chunk);
+        }
+    }
+}
+
+// A chunk can only be meshed once all four chunks beside it have block data for the faces along its edges
+bool neighboursHaveData(World* world, int cx, int cz) {
+    for (int face = FRONT; face <= RIGHT; face++) {
+        Chunk* neighbour = getNeighbour(world, cx, cz, face);
+        if(!neighbour || !chunkHasData(neighbour)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Neighbour data never changes once generated so the borders only need copying once, here on the render thread
+void copyChunkBorders(World* world, Chunk* chunk) {
+    for (int s = 0; s < chunk->sectionCount; s++) {
+        ChunkSection* section = &chunk->sections[s];
+        for (int face = FRONT; face <= RIGHT; face++) {
+            Chunk* neighbour = getNeighbour(world, chunk->cx, chunk->cz, face);
+            copyNeighbourBorder(section, neighbour ? &neighbour->sections[s] : NULL, face);
+        }
+        copyNeighbourBorder(section, s + 1 < chunk->sectionCount ? &chunk->sections[s + 1] : NULL, TOP);
+        if(s > 0) {
+            copyNeighbourBorder(section, &chunk->sections[s - 1], BOTTOM);
+        }
+        else {
+            closeSectionFace(section, BOTTOM);
+        }
+    }
+}
+
+// Returns false when the job system is full, the chunk is left as it was for a later frame
+bool submitChunkJob(World* world, JobSystem* jobs, Chunk* chunk, ChunkJobStage stage) {
+    int slot = (int)(chunk - world->chunks);
+    chunk->state = stage == JOB_DATA ? CHUNK_GENERATING : CHUNK_MESHING;
+    world->jobs[slot] = (ChunkJob){chunk, stage, world->seed, &world->profile, meshMode, world->stats, world->scratch, &world->completed};
+    if(!submitJob(jobs, buildChunkJob, &world->jobs[slot])) {
+        if(stage == JOB_DATA) {
+            chunkMapRemove(&world->map, chunk->cx, chunk->cz);
+            world->freeSlots[world->freeCount++] = slot;
+        }
+        else {
+            chunk->state = CHUNK_HAS_DATA;
+        }
+        return false;
+    }
+    world->inFlight++;
+    return true;
+}
+
+void scheduleChunks(World* world, JobSystem* jobs, vec3 cameraPos, vec3 cameraFront) {
+    int count = 0;
+    int dataRadius = world->radius + 1;
+    for (int dx = -dataRadius; dx <= dataRadius; dx++) {
+        for (int dz = -dataRadius; dz <= dataRadius; dz++) {
+            int distance = dx * dx + dz * dz;
+            if(distance > dataRadius * dataRadius) {
+                continue;
+            }
+            int cx = world->centerX + dx;
+            int cz = world->centerZ + dz;
+            Chunk* chunk = getChunk(world, cx, cz);
+            ChunkJobStage stage;
+            if(!chunk) {
+                stage = JOB_DATA;
+            }
+            else if(chunk->state == CHUNK_HAS_DATA && distance <= world->radius * world->radius && neighboursHaveData(world, cx, cz)) {
+                stage = JOB_MESH;
+            }
+            else {
+                continue;
+            }
+            world->candidates[count].cx = cx;
+            world->candidates[count].cz = cz;
+            world->candidates[count].stage = stage;
+            world->candidates[count].priority = chunkPriority(cx, cz, cameraPos, cameraFront);
+            count++;
+        }
+    }
+    if(count == 0) {
+        if(world->inFlight == 0 && world->chunksBuilt + world->sectionsEmpty + world->sectionsOccluded > 0) {
+            printGenerationStats(world);
+        }
+        return;
+    }
+    if(world->inFlight == 0 && world->chunksBuilt == 0) {
+        world->loadStart = glfwGetTime();
+    }
+    qsort(world->candidates, count, sizeof(ChunkCandidate), compareCandidates);
+    for (int i = 0; i < count && world->inFlight < world->maxInFlight; i++) {
+        ChunkCandidate* candidate = &world->candidates[i];
+        if(candidate->stage == JOB_MESH) {
+            Chunk* chunk = getChunk(world, candidate->cx, candidate->cz);
+            copyChunkBorders(world, chunk);
+            // Nothing in an empty or buried section can be seen, so it gets no mesh, GL objects or draws
+            // and a column without anything to show is ready straight away
+            int empty = 0, occluded = 0, visible = 0;
+            for (int s = 0; s < chunk->sectionCount; s++) {
+                ChunkSection* section = &chunk->sections[s];
+                section->vertexCount = 0;
+                section->needsMesh = false;
+                if(section->nonAirCount == 0) empty++;
+                else if(isSectionOccluded(section)) occluded++;
+                else {
+                    section->needsMesh = true;
+                    visible++;
+                }
+            }
+            if(visible == 0) {
+                chunk->state = CHUNK_READY;
+            }
+            else if(!submitChunkJob(world, jobs, chunk, JOB_MESH)) {
+                continue;
+            }
+            world->sectionsEmpty += empty;
+            world->sectionsOccluded += occluded;
+            continue;
+        }
+        if(world->freeCount == 0) {
+            continue;
+        }
+        int slot = world->freeSlots[--world->freeCount];
+        chunkMapInsert(&world->map, candidate->cx, candidate->cz, slot);
+        Chunk* chunk = &world->chunks[slot];
+        chunk->cx = candidate->cx;
+        chunk->cz = candidate->cz;
+        glm_vec3_copy((vec3){chunk->cx * CHUNK_SIZE, 0, chunk->cz * CHUNK_SIZE}, chunk->pos);
+        submitChunkJob(world, jobs, chunk, JOB_DATA);
+    }
+}
+
+// Called once per frame on the render thread, loads chunks in rings around the camera and evicts the ones left behind
+void updateWorld(World* world, JobSystem* jobs, vec3 cameraPos, vec3 cameraFront, long uploadBudget) {
+    uploadCompletedChunks(world, uploadBudget);
+    int centerX = (int)floorf(cameraPos[0] / CHUNK_SIZE);
+    int centerZ = (int)floorf(cameraPos[2] / CHUNK_SIZE);
+    if(centerX != world->centerX || centerZ != world->centerZ) {
+        world->centerX = centerX;
+        world->centerZ = centerZ;
+        evictChunks(world);
+    }
+    if(world->inFlight < world->maxInFlight) {
+        scheduleChunks(world, jobs, cameraPos, cameraFront);
+    }
+}
@@ -0,0 +1,165 @@
+// Checks the chunk map against a plain array of loaded chunks through inserts, updates and removals,
+// including probe runs that collide on one bucket and runs that wrap past the end of the table.
+// Build and run with make -C tests
+#include <stdio.h>
+#include <stdlib.h>
+#include "chunkmap.h"
+
+#define REFERENCE_SIZE 64
+
+int failures = 0;
+
+void expect(bool condition, const char* what) {
+    if(!condition) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+// Every entry has to be reachable from its home bucket without crossing an empty one, or lookups miss it
+bool runsIntact(ChunkMap* map) {
+    int count = 0;
+    for(uint32_t i = 0; i <= map->mask; i++) {
+        if(map->entries[i].slot == -1) {
+            continue;
+        }
+        count++;
+        if(chunkMapFind(map, map->entries[i].cx, map->entries[i].cz) != map->entries[i].slot) {
+            return false;
+        }
+    }
+    return count == map->count;
+}
+
+// Collects coordinates whose home bucket is bucket, starting the search at cx
+int findColliding(ChunkMap* map, uint32_t bucket, int cx, int coords[][2], int amount) {
+    int found = 0;
+    for(int cz = 0; found < amount; cz++) {
+        if((hashChunkCoord(cx, cz) & map->mask) == bucket) {
+            coords[found][0] = cx;
+            coords[found][1] = cz;
+            found++;
+        }
+    }
+    return found;
+}
+
+void testBasics(void) {
+    ChunkMap map;
+    createChunkMap(&map, 100);
+    expect(map.mask + 1 >= 200, "the table is at least twice the requested entries");
+    expect(chunkMapFind(&map, 0, 0) == -1, "an empty map finds nothing");
+    chunkMapInsert(&map, 3, -7, 12);
+    chunkMapInsert(&map, -7, 3, 13);
+    expect(chunkMapFind(&map, 3, -7) == 12 && chunkMapFind(&map, -7, 3) == 13, "inserted chunks are found");
+    expect(map.count == 2, "inserts are counted");
+    chunkMapInsert(&map, 3, -7, 40);
+    expect(chunkMapFind(&map, 3, -7) == 40 && map.count == 2, "inserting a loaded chunk again updates its slot");
+    chunkMapRemove(&map, 5, 5);
+    expect(map.count == 2, "removing a missing chunk changes nothing");
+    chunkMapRemove(&map, 3, -7);
+    expect(chunkMapFind(&map, 3, -7) == -1 && chunkMapFind(&map, -7, 3) == 13, "removal only drops its own chunk");
+    expect(map.count == 1, "removals are counted");
+    clearChunkMap(&map);
+    expect(chunkMapFind(&map, -7, 3) == -1 && map.count == 0, "clearing empties the map");
+    destroyChunkMap(&map);
+}
+
+// Removes each position out of a run of colliding keys and checks the rest are shifted back to stay reachable
+void testBackwardShift(uint32_t bucket, const char* name) {
+    ChunkMap map;
+    createChunkMap(&map, 8);
+    int run[6][2];
+    int other[2][2];
+    findColliding(&map, bucket, 1, run, 6);
+    findColliding(&map, (bucket + 2) & map.mask, 2, other, 2);
+    char what[128];
+    for(int removed = 0; removed < 6; removed++) {
+        clearChunkMap(&map);
+        // The other keys land inside the colliding run so the shift has to step over entries it may not move
+        for(int k = 0; k < 6; k++) {
+            chunkMapInsert(&map, run[k][0], run[k][1], k);
+            if(k == 1) {
+                chunkMapInsert(&map, other[0][0], other[0][1], 100);
+                chunkMapInsert(&map, other[1][0], other[1][1], 101);
+            }
+        }
+        chunkMapRemove(&map, run[removed][0], run[removed][1]);
+        bool found = chunkMapFind(&map, run[removed][0], run[removed][1]) == -1;
+        for(int k = 0; k < 6; k++) {
+            if(k != removed) {
+                found = found && chunkMapFind(&map, run[k][0], run[k][1]) == k;
+            }
+        }
+        found = found && chunkMapFind(&map, other[0][0], other[0][1]) == 100;
+        found = found && chunkMapFind(&map, other[1][0], other[1][1]) == 101;
+        snprintf(what, sizeof(what), "%s: removing entry %d of a colliding run keeps the others reachable", name, removed);
+        expect(found && runsIntact(&map) && map.count == 7, what);
+    }
+    destroyChunkMap(&map);
+}
+
+// Random churn against a plain array, with the map as full as the world lets it get
+void testRandom(void) {
+    ChunkMap map;
+    createChunkMap(&map, REFERENCE_SIZE);
+    int reference[REFERENCE_SIZE][3];
+    int loaded = 0;
+    bool matches = true;
+    bool intact = true;
+    for(int step = 0; step < 200000; step++) {
+        int cx = rand() % 24 - 12;
+        int cz = rand() % 24 - 12;
+        int index = -1;
+        for(int k = 0; k < loaded; k++) {
+            if(reference[k][0] == cx && reference[k][1] == cz) {
+                index = k;
+            }
+        }
+        int action = rand() % 3;
+        if(action == 0 && (index != -1 || loaded < REFERENCE_SIZE)) {
+            int slot = rand() % 1000;
+            chunkMapInsert(&map, cx, cz, slot);
+            if(index == -1) {
+                index = loaded++;
+            }
+            reference[index][0] = cx;
+            reference[index][1] = cz;
+            reference[index][2] = slot;
+        } else if(action == 1) {
+            chunkMapRemove(&map, cx, cz);
+            if(index != -1) {
+                reference[index][0] = reference[loaded - 1][0];
+                reference[index][1] = reference[loaded - 1][1];
+                reference[index][2] = reference[loaded - 1][2];
+                loaded--;
+            }
+        } else {
+            matches = matches && chunkMapFind(&map, cx, cz) == (index == -1 ? -1 : reference[index][2]);
+        }
+        matches = matches && map.count == loaded;
+        if(step % 1000 == 0) {
+            intact = intact && runsIntact(&map);
+            for(int k = 0; k < loaded; k++) {
+                matches = matches && chunkMapFind(&map, reference[k][0], reference[k][1]) == reference[k][2];
+            }
+        }
+    }
+    expect(matches, "random inserts and removals match the reference");
+    expect(intact, "random inserts and removals keep every probe run intact");
+    destroyChunkMap(&map);
+}
+
+int main(void) {
+    srand(5);
+    testBasics();
+    testBackwardShift(3, "run in the middle");
+    testBackwardShift(13, "run wrapping past the end");
+    testRandom();
+    if(failures > 0) {
+        fprintf(stderr, "%d chunk map checks failed\n", failures);
+        return 1;
+    }
+    printf("All chunk map checks passed\n");
+    return 0;
+}
@@ -0,0 +1,148 @@
+// CPU only checks that greedy meshing covers exactly the faces naive meshing emits, with the same block type,
+// winding and one texture repeat per block. Meshes stay in the vertex pool, nothing is uploaded.
+// Build and run with make -C tests
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "jobs.h"
+#include "block.h"
+
+// block.h only uses GLFW to time jobs
+double glfwGetTime(void) {
+    return 0.0;
+}
+
+TerrainProfile profile = {TERRAIN_DENSITY, 128.0f, 5, 0.5f, 2.0f, 16.0f, 112.0f, 52, 24.0f, 8.0f, 0.3f, 4};
+
+// Block type of every unit face covered by a mesh, 0 where none is, and how many quads cover it
+uint16_t covered[2][6][CHUNK_SIZE][CHUNK_SIZE][CHUNK_SIZE];
+uint8_t coverCount[2][6][CHUNK_SIZE][CHUNK_SIZE][CHUNK_SIZE];
+MeshScratch scratch;
+int failures = 0;
+
+void expect(bool condition, const char* what) {
+    if(!condition) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+void unpackPosition(Vertex vertex, int pos[3]) {
+    pos[0] = vertex.position & 63;
+    pos[1] = (vertex.position >> 6) & 63;
+    pos[2] = (vertex.position >> 12) & 63;
+}
+
+// Records the unit faces each quad covers and checks its winding and texture coordinates
+void coverMesh(ChunkSection* section, int mode, long* quads) {
+    for(int q = 0; q < section->vertexCount; q += 4) {
+        Vertex* corners = &section->vertices[q];
+        int face = (corners[0].position >> 18) & 7;
+        uint16_t type = (uint16_t)(corners[0].texture >> 12);
+        int p[4][3];
+        int min[3] = {CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE}, max[3] = {0, 0, 0};
+        int maxU = 0, maxV = 0;
+        for(int i = 0; i < 4; i++) {
+            unpackPosition(corners[i], p[i]);
+            for(int axis = 0; axis < 3; axis++) {
+                min[axis] = p[i][axis] < min[axis] ? p[i][axis] : min[axis];
+                max[axis] = p[i][axis] > max[axis] ? p[i][axis] : max[axis];
+            }
+            int u = corners[i].texture & 63, v = (corners[i].texture >> 6) & 63;
+            maxU = u > maxU ? u : maxU;
+            maxV = v > maxV ? v : maxV;
+            expect(((corners[i].position >> 18) & 7) == (uint32_t)face && (corners[i].texture >> 12) == type,
+                "every corner of a quad has the same face and block type");
+        }
+        // The first edge is u and the last is v, the normal of the first triangle has to point out of the face
+        int e1[3], e2[3];
+        for(int axis = 0; axis < 3; axis++) {
+            e1[axis] = p[1][axis] - p[0][axis];
+            e2[axis] = p[3][axis] - p[0][axis];
+        }
+        int normal[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+        int n = faceAxis[face];
+        expect(normal[n] * faceDirection[face] > 0, "quads wind towards the way their face points");
+        expect(maxU == abs(e1[0] + e1[1] + e1[2]) && maxV == abs(e2[0] + e2[1] + e2[2]),
+            "texture coordinates run one unit per block");
+        // The face sits on the low or high side of its block
+        int layer = min[n] - (faceDirection[face] > 0 ? 1 : 0);
+        int u = (n + 1) % 3, v = (n + 2) % 3;
+        for(int i = min[u]; i < max[u]; i++) {
+            for(int j = min[v]; j < max[v]; j++) {
+                int pos[3];
+                pos[n] = layer;
+                pos[u] = i;
+                pos[v] = j;
+                covered[mode][face][pos[0]][pos[1]][pos[2]] = type;
+                coverCount[mode][face][pos[0]][pos[1]][pos[2]]++;
+            }
+        }
+        (*quads)++;
+    }
+}
+
+long naiveQuads = 0, greedyQuads = 0;
+
+void compareMeshes(ChunkSection* section) {
+    memset(covered, 0, sizeof(covered));
+    memset(coverCount, 0, sizeof(coverCount));
+    section->needsMesh = true;
+    createSectionMesh(section, &scratch);
+    coverMesh(section, 0, &naiveQuads);
+    freeSectionVertices(section);
+    createSectionMeshGreedy(section, &scratch);
+    coverMesh(section, 1, &greedyQuads);
+    freeSectionVertices(section);
+    expect(memcmp(covered[0], covered[1], sizeof(covered[0])) == 0, "greedy covers the same faces with the same types");
+    bool once = true;
+    for(size_t i = 0; i < sizeof(coverCount[1]); i++) {
+        once = once && (&coverCount[1][0][0][0][0])[i] <= 1;
+    }
+    expect(once, "greedy never covers a face twice");
+}
+
+int main(void) {
+    if(!createPool(&vertexPool) || !createPool(&blockPool) || !createMeshScratch(&scratch)) {
+        return 1;
+    }
+    int seed = 99;
+    buildNoiseTable(seed);
+    ChunkSection sections[4];
+    memset(sections, 0, sizeof(sections));
+    Chunk chunk = {sections, 4};
+    int meshed = 0;
+    // Generated terrain in both modes
+    for(int i = 0; i < 20; i++) {
+        profile.mode = i % 2 ? TERRAIN_HEIGHTMAP : TERRAIN_DENSITY;
+        glm_vec3_copy((vec3){i * 3 * CHUNK_SIZE, 0.0f, i * 5 * CHUNK_SIZE}, chunk.pos);
+        createChunkData(&chunk, &profile, seed, &scratch);
+        for(int s = 0; s < chunk.sectionCount; s++) {
+            if(sections[s].nonAirCount > 0) {
+                compareMeshes(&sections[s]);
+                meshed++;
+            }
+        }
+    }
+    // Scattered blocks of mixed types, where merging is hardest to get right
+    srand(7);
+    for(int i = 0; i < 4; i++) {
+        uint16_t* blocks = &scratch.blocks[0][0][0];
+        for(int b = 0; b < PALETTE_VOLUME; b++) {
+            blocks[b] = rand() % (i + 2) == 0 ? (uint16_t)(BLOCK_DIRT + rand() % 2) : BLOCK_AIR;
+        }
+        computeSectionMetadata(&sections[0], scratch.blocks);
+        packBlocks(&sections[0].storage, blocks);
+        compareMeshes(&sections[0]);
+        meshed++;
+    }
+    expect(greedyQuads < naiveQuads, "greedy meshing merges faces");
+    destroyMeshScratch(&scratch);
+    if(failures > 0) {
+        fprintf(stderr, "%d mesh checks failed\n", failures);
+        return 1;
+    }
+    printf("All mesh checks passed, %d sections, %ld naive quads, %ld greedy quads\n", meshed, naiveQuads, greedyQuads);
+    return 0;
+}
@@ -0,0 +1,96 @@
+// CPU only checks of the occlusion culling stage, no GL context is needed.
+// Build and run with make -C tests
+#include <stdio.h>
+#include <stdlib.h>
+#include <cglm/cglm.h>
+
+#define CHUNK_SIZE 32
+
+#include "occlusion.h"
+
+uint16_t blocks[CHUNK_SIZE][CHUNK_SIZE][CHUNK_SIZE];
+OccluderLayers layers;
+int failures = 0;
+
+void expect(bool condition, const char* what) {
+    if(!condition) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+void expectOccluded(vec3 min, vec3 max, bool occluded, const char* what) {
+    vec3 bounds[2];
+    glm_vec3_copy(min, bounds[0]);
+    glm_vec3_copy(max, bounds[1]);
+    expect(isBoxOccluded(&occlusion, bounds) == occluded, what);
+}
+
+// Looks down +z from in front of a section at the origin
+void drawSection(vec3 eye) {
+    mat4 projection, view, viewProjection;
+    glm_perspective(glm_rad(90.0f), (float)OCCLUSION_WIDTH / OCCLUSION_HEIGHT, 0.1f, 1000.0f, projection);
+    glm_lookat(eye, (vec3){eye[0], eye[1], eye[2] + 1.0f}, (vec3){0.0f, 1.0f, 0.0f}, view);
+    glm_mat4_mul(projection, view, viewProjection);
+    clearOcclusionBuffer(&occlusion, viewProjection);
+    findOccluderLayers(layers, blocks);
+    drawSectionOccluders(&occlusion, layers, (vec3){0.0f, 0.0f, 0.0f}, eye);
+}
+
+void testWall(void) {
+    // A solid wall one block thick across the whole section at z = 4
+    memset(blocks, 0, sizeof(blocks));
+    for(int x = 0; x < CHUNK_SIZE; x++) {
+        for(int y = 0; y < CHUNK_SIZE; y++) {
+            blocks[x][y][4] = 1;
+        }
+    }
+    drawSection((vec3){16.0f, 16.0f, -24.0f});
+    expect(layers[2][0][0][0] == 4 && layers[2][1][0][0] == 4, "the wall is found as a plate along z");
+    expect(layers[0][0][0][0] == -1 && layers[1][0][0][0] == -1, "no plates are found along x or y");
+    expect(occlusion.occluders > 0, "the wall is drawn into the buffer");
+
+    expectOccluded((vec3){4.0f, 4.0f, 10.0f}, (vec3){28.0f, 28.0f, 20.0f}, true, "a box behind the wall is hidden");
+    expectOccluded((vec3){4.0f, 4.0f, 64.0f}, (vec3){28.0f, 28.0f, 96.0f}, true, "a box far behind the wall is hidden");
+    expectOccluded((vec3){4.0f, 4.0f, -16.0f}, (vec3){28.0f, 28.0f, -8.0f}, false, "a box in front of the wall is kept");
+    expectOccluded((vec3){40.0f, 4.0f, 10.0f}, (vec3){56.0f, 28.0f, 20.0f}, false, "a box beside the wall is kept");
+    expectOccluded((vec3){20.0f, 4.0f, 10.0f}, (vec3){44.0f, 28.0f, 20.0f}, false, "a box partly behind the wall is kept");
+    expectOccluded((vec3){4.0f, 4.0f, 2.0f}, (vec3){28.0f, 28.0f, 12.0f}, false, "a box through the wall is kept");
+    expectOccluded((vec3){8.0f, 8.0f, -40.0f}, (vec3){24.0f, 24.0f, 20.0f}, false, "a box around the eye is kept");
+}
+
+void testHole(void) {
+    // The same wall with one block missing, the tile holding it gives no plate
+    memset(blocks, 0, sizeof(blocks));
+    for(int x = 0; x < CHUNK_SIZE; x++) {
+        for(int y = 0; y < CHUNK_SIZE; y++) {
+            blocks[x][y][4] = 1;
+        }
+    }
+    blocks[12][12][4] = 0;
+    drawSection((vec3){16.0f, 16.0f, -24.0f});
+    expect(layers[2][0][1][1] == -1, "the tile with the hole gives no plate");
+    expect(layers[2][0][0][0] == 4, "the other tiles still give plates");
+
+    expectOccluded((vec3){11.0f, 11.0f, 10.0f}, (vec3){13.0f, 13.0f, 12.0f}, false, "a box behind the hole is kept");
+    expectOccluded((vec3){20.0f, 20.0f, 10.0f}, (vec3){28.0f, 28.0f, 12.0f}, true, "a box behind a whole tile is hidden");
+}
+
+void testEmpty(void) {
+    memset(blocks, 0, sizeof(blocks));
+    drawSection((vec3){16.0f, 16.0f, -24.0f});
+    expect(occlusion.occluders == 0, "an empty section draws nothing");
+    expectOccluded((vec3){4.0f, 4.0f, 10.0f}, (vec3){28.0f, 28.0f, 20.0f}, false, "nothing is hidden by an empty buffer");
+}
+
+int main(void) {
+    testWall();
+    testHole();
+    testEmpty();
+    if(failures > 0) {
+        fprintf(stderr, "%d occlusion checks failed\n", failures);
+        return 1;
+    }
+    printf("All occlusion checks passed\n");
+    return 0;
+}
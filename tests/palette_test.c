@@ -0,0 +1,110 @@
+// Round trips blocks through the palette compressed storage at every width, including the single block
+// fast path and the promotions setStoredBlock makes as new block types arrive.
+// Build and run with make -C tests
+#include <stdio.h>
+#include <stdlib.h>
+#include "queue.h"
+
+#define CHUNK_SIZE 32
+
+#include "palette.h"
+
+uint16_t blocks[PALETTE_VOLUME];
+uint16_t unpacked[PALETTE_VOLUME];
+int failures = 0;
+
+void expect(bool condition, const char* what) {
+    if(!condition) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+bool matchesBlocks(const BlockStorage* storage) {
+    for(int i = 0; i < PALETTE_VOLUME; i++) {
+        if(getStoredBlock(storage, i) != blocks[i]) {
+            return false;
+        }
+    }
+    unpackBlocks(storage, unpacked);
+    return memcmp(unpacked, blocks, sizeof(blocks)) == 0;
+}
+
+// Fills blocks with types values spread through the section, in runs like terrain and scattered like caves
+void fillBlocks(int types, bool scattered) {
+    for(int i = 0; i < PALETTE_VOLUME; i++) {
+        int value = scattered ? rand() % types : (i / 37) % types;
+        blocks[i] = (uint16_t)(value * 7 + 1);
+    }
+    // Every type has to appear at least once for the palette to need it
+    for(int t = 0; t < types; t++) {
+        blocks[t * 101] = (uint16_t)(t * 7 + 1);
+    }
+}
+
+void testPack(void) {
+    static const int types[] = {1, 2, 3, 4, 5, 16, 17, 300};
+    static const uint8_t bits[] = {0, 1, 2, 2, 4, 4, 16, 16};
+    for(int t = 0; t < (int)(sizeof(types) / sizeof(types[0])); t++) {
+        for(int scattered = 0; scattered < 2; scattered++) {
+            BlockStorage storage = {0};
+            fillBlocks(types[t], scattered);
+            expect(packBlocks(&storage, blocks), "packing succeeds");
+            char what[96];
+            snprintf(what, sizeof(what), "%d block types pack at %d bits", types[t], bits[t]);
+            expect(storage.bits == bits[t], what);
+            snprintf(what, sizeof(what), "%d block types round trip", types[t]);
+            expect(matchesBlocks(&storage), what);
+            fillBlockStorage(&storage, 0);
+        }
+    }
+}
+
+// Adds one new block type at a time with setStoredBlock, the storage has to widen exactly when the palette outgrows it
+void testPromotion(void) {
+    BlockStorage storage = {0};
+    fillBlockStorage(&storage, 5);
+    for(int i = 0; i < PALETTE_VOLUME; i++) {
+        blocks[i] = 5;
+    }
+    expect(isUniformStorage(&storage) && matchesBlocks(&storage), "a filled storage holds one block without any words");
+    expect(setStoredBlock(&storage, 10, 5) && isUniformStorage(&storage), "setting the same block keeps the fast path");
+    for(int types = 2; types <= 20; types++) {
+        uint16_t block = (uint16_t)(100 + types);
+        // Written across word boundaries of every width
+        int indices[] = {0, 63, 64, 127, 128, PALETTE_VOLUME - 1, rand() % PALETTE_VOLUME};
+        for(int k = 0; k < (int)(sizeof(indices) / sizeof(indices[0])); k++) {
+            expect(setStoredBlock(&storage, indices[k], block), "setting a block succeeds");
+            blocks[indices[k]] = block;
+        }
+        // Earlier types are overwritten here and there so the old indices have to survive the promotion
+        for(int k = 0; k < 200; k++) {
+            int index = rand() % PALETTE_VOLUME;
+            uint16_t earlier = (uint16_t)(rand() % 2 ? 5 : 100 + 2 + rand() % (types - 1));
+            setStoredBlock(&storage, index, earlier);
+            blocks[index] = earlier;
+        }
+        char what[96];
+        snprintf(what, sizeof(what), "%d block types set one at a time are stored at %d bits", types, paletteBits(types));
+        expect(storage.bits == paletteBits(types), what);
+        snprintf(what, sizeof(what), "%d block types set one at a time read back", types);
+        expect(matchesBlocks(&storage), what);
+    }
+    fillBlockStorage(&storage, 0);
+}
+
+int main(void) {
+    if(!createPool(&blockPool)) {
+        return 1;
+    }
+    srand(11);
+    testPack();
+    testPromotion();
+    destroyPool(&blockPool);
+    if(failures > 0) {
+        fprintf(stderr, "%d palette checks failed\n", failures);
+        return 1;
+    }
+    printf("All palette checks passed\n");
+    return 0;
+}